@@ -0,0 +1,118 @@
+#include "audio.h"
+
+#include <stddef.h>
+#include <math.h>
+
+// Goertzel filter centre frequencies in Hz, below AUDIO_SAMPLE_RATE / 2
+const int band_frequencies[AUDIO_BAND_COUNT] = { 40, 55, 70, 85, 100, 115 };
+
+#define LOG_RANGE       64  // 4 octaves of power in 4.4 fixed point log2
+#define BEAT_THRESHOLD  24  // low band this far over its average is a beat
+#define BEAT_HOLDOFF    2   // blocks, ~250ms
+
+audio_source_t *_source;
+bool _enabled = false;
+audio_levels_t _levels;
+
+int32_t coefficients[AUDIO_BAND_COUNT]; // 2cos(w) in Q14
+int32_t s1[AUDIO_BAND_COUNT];
+int32_t s2[AUDIO_BAND_COUNT];
+int block_samples = 0;
+int32_t dc = 0;                          // Q8
+int peak = 0;                            // loudest band, 4.4 log2, slowly decaying
+int beat_average = 0;
+int beat_holdoff = 0;
+// off the ws2812Service stack, which is only 255 words
+int16_t step_samples[AUDIO_MAX_SAMPLES_PER_STEP];
+
+void audio_init(audio_source_t *source) {
+	_source = source;
+	for (int b = 0; b < AUDIO_BAND_COUNT; b++) {
+		coefficients[b] = 2 * cos(2 * M_PI * band_frequencies[b] / AUDIO_SAMPLE_RATE) * (1 << 14);
+	}
+}
+
+void audio_enable(bool enabled) {
+	if (enabled == _enabled || _source == NULL) return;
+	_enabled = enabled;
+	if (_enabled) {
+		_source->start(_source);
+	}
+	else {
+		_source->stop(_source);
+	}
+}
+
+// 4.4 fixed point log2, 0 for 0
+static int log2_44(uint32_t value) {
+	if (value == 0) return 0;
+	int bits = 31 - __builtin_clz(value);
+	int frac = bits >= 4 ? (value >> (bits - 4)) & 0xF : (value << (4 - bits)) & 0xF;
+	return (bits << 4) | frac;
+}
+
+static void finishBlock() {
+	int levels[AUDIO_BAND_COUNT];
+	int loudest = 0;
+	for (int b = 0; b < AUDIO_BAND_COUNT; b++) {
+		// squared magnitude of the bin, about 2^22 for a full scale tone on
+		// the band and under 2^30 at worst, rounding can take it just below 0
+		int32_t power = s1[b] * s1[b] + s2[b] * s2[b] - ((coefficients[b] * s1[b] >> 14) * s2[b]);
+		s1[b] = s2[b] = 0;
+		int level = log2_44(power > 0 ? power >> 8 : 0);
+		levels[b] = level;
+		if (level > loudest) loudest = level;
+
+		if (b == 0) {
+			if (beat_holdoff > 0) {
+				beat_holdoff--;
+			}
+			else if (level > beat_average + BEAT_THRESHOLD) {
+				_levels.beats++;
+				beat_holdoff = BEAT_HOLDOFF;
+			}
+			beat_average += (level - beat_average) >> 3;
+		}
+	}
+
+	// auto gain shared by all bands: the top LOG_RANGE under the recent peak maps to 0 - 255
+	if (loudest > peak) peak = loudest;
+	else if (peak > LOG_RANGE) peak--;
+	for (int b = 0; b < AUDIO_BAND_COUNT; b++) {
+		int scaled = (levels[b] - (peak - LOG_RANGE)) * 255 / LOG_RANGE;
+		_levels.bands[b] = scaled < 0 ? 0 : scaled > 255 ? 255 : scaled;
+	}
+	block_samples = 0;
+}
+
+void audio_step() {
+	if (!_enabled) return;
+
+	int count = _source->read(_source, step_samples, AUDIO_MAX_SAMPLES_PER_STEP);
+	for (int i = 0; i < count; i++) {
+		// remove the ADC bias and scale the 10 bit input to +-128
+		int32_t x = step_samples[i] << 8;
+		dc += (x - dc) >> 7;
+		x = (x - dc) >> 10;
+
+		for (int b = 0; b < AUDIO_BAND_COUNT; b++) {
+			// a block of 32 full scale samples keeps the state under 2^14 even
+			// on the top band, so the Q14 product fits in 32 bits
+			int32_t s = x + ((coefficients[b] * s1[b]) >> 14) - s2[b];
+			s2[b] = s1[b];
+			s1[b] = s;
+		}
+		if (++block_samples == AUDIO_BLOCK_SIZE) finishBlock();
+	}
+}
+
+const audio_levels_t *audio_levels() {
+	return &_levels;
+}
+
+uint32_t audio_takeIsrTimeMax() {
+	if (_source == NULL) return 0;
+	uint32_t isr_time_max = _source->isr_time_max;
+	_source->isr_time_max = 0;
+	return isr_time_max;
+}
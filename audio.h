@@ -0,0 +1,49 @@
+#ifndef audio_h
+#define audio_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The SDK's ADC read shares the RF block with WiFi and drops the connection
+// when called every few hundred us, so TOUT is only read every 4ms. That
+// leaves the bass up to 125Hz: enough to find beats, with a coarse bass
+// spectrum. The input needs a low pass below that (an RC of about 100Hz on
+// TOUT) or higher frequencies alias into the bands.
+#define AUDIO_SAMPLE_RATE           250
+#define AUDIO_BLOCK_SIZE            32  // samples per analysis block, 128ms
+#define AUDIO_BAND_COUNT            6
+#define AUDIO_MAX_SAMPLES_PER_STEP  16  // bounds the work done by one audio_step
+
+typedef struct audio_source audio_source_t;
+
+// where samples come from, read is called from the ws2812Service task
+struct audio_source {
+	void (*start)(audio_source_t *source);
+	void (*stop)(audio_source_t *source);
+	// copies up to count pending samples, returns how many
+	int (*read)(audio_source_t *source, int16_t *samples, int count);
+	volatile uint32_t isr_time_max; // us spent in the sampling interrupt at most, 0 without one
+};
+
+// TOUT pin sampled from the FRC1 timer interrupt, in audio_adc.c
+audio_source_t *audio_source_adc();
+
+typedef struct {
+	uint8_t bands[AUDIO_BAND_COUNT]; // 0 - 255, lowest frequency first
+	uint32_t beats;                  // counts detected beats, compare to see a new one
+} audio_levels_t;
+
+void audio_init(audio_source_t *source);
+
+// starts or stops sampling, only audio effects need it running
+void audio_enable(bool enabled);
+
+// analyses at most AUDIO_MAX_SAMPLES_PER_STEP pending samples
+void audio_step();
+
+const audio_levels_t *audio_levels();
+
+// longest sampling interrupt since the last call in us, for telemetry
+uint32_t audio_takeIsrTimeMax();
+
+#endif
@@ -0,0 +1,67 @@
+#include "audio.h"
+
+#include <stddef.h>
+#include <esp8266.h>
+#include <esp/timer.h>
+#include <espressif/esp_system.h>
+
+// TOUT pin sampled from the FRC1 timer interrupt, kept apart from the
+// analysis in audio.c so that builds on the host
+
+#define RING_SIZE 64 // power of two, 256ms
+
+typedef struct {
+	audio_source_t source;
+	volatile uint16_t head;
+	volatile uint16_t tail;
+	int16_t ring[RING_SIZE];
+} adc_source_t;
+
+adc_source_t adc_source;
+
+// runs 250 times a second, the ADC read is nearly all of its time
+static void adc_isr(void *arg) {
+	uint32_t start = sdk_system_get_time();
+	uint16_t next = (adc_source.head + 1) & (RING_SIZE - 1);
+	// when the analysis falls behind the newest samples are dropped
+	if (next != adc_source.tail) {
+		adc_source.ring[adc_source.head] = sdk_system_adc_read();
+		adc_source.head = next;
+	}
+	uint32_t elapsed = sdk_system_get_time() - start;
+	if (elapsed > adc_source.source.isr_time_max) adc_source.source.isr_time_max = elapsed;
+}
+
+static void adc_start(audio_source_t *source) {
+	adc_source.head = adc_source.tail = 0;
+	timer_set_interrupts(FRC1, false);
+	timer_set_run(FRC1, false);
+	_xt_isr_attach(INUM_TIMER_FRC1, adc_isr, NULL);
+	timer_set_frequency(FRC1, AUDIO_SAMPLE_RATE);
+	timer_set_interrupts(FRC1, true);
+	timer_set_run(FRC1, true);
+}
+
+static void adc_stop(audio_source_t *source) {
+	timer_set_interrupts(FRC1, false);
+	timer_set_run(FRC1, false);
+}
+
+static int adc_read(audio_source_t *source, int16_t *samples, int count) {
+	int n = 0;
+	uint16_t tail = adc_source.tail;
+	while (n < count && tail != adc_source.head) {
+		samples[n++] = adc_source.ring[tail];
+		tail = (tail + 1) & (RING_SIZE - 1);
+	}
+	adc_source.tail = tail;
+	return n;
+}
+
+audio_source_t *audio_source_adc() {
+	adc_source.source.start = adc_start;
+	adc_source.source.stop = adc_stop;
+	adc_source.source.read = adc_read;
+	adc_source.source.isr_time_max = 0;
+	return &adc_source.source;
+}
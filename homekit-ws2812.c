@@ -8,11 +8,14 @@
 #include <stdlib.h>
 #include <espressif/esp_wifi.h>
 #include <espressif/esp_sta.h>
+#include <espressif/esp_system.h>
 #include <esp/uart.h>
 #include <esp8266.h>
 #include <FreeRTOS.h>
 #include <task.h>
+#include <timers.h>
 #include <math.h>
+#include <string.h>
 
 #include <homekit/homekit.h>
 #include <homekit/characteristics.h>
@@ -20,10 +23,27 @@
 
 #include "converters.h"
 #include "ws2812.h"
+#include "audio.h"
+#include "scene.h"
+#include "storage.h"
 #include "homekit_conf.h"
 
 #define LED_INBUILT_GPIO 2 // this is the onboard LED used to show on/off only
 
+// optional second strip, bit-banged on LED2_GPIO and appended after the first
+#ifndef LED2_COUNT
+#define LED2_COUNT 0
+#endif
+#define LED_TOTAL_COUNT (LED_COUNT + LED2_COUNT)
+
+// power budget, a WS2812 channel draws about 20mA at full on
+#ifndef LED_MA_PER_CHANNEL
+#define LED_MA_PER_CHANNEL 20
+#endif
+#ifndef PSU_LIMIT_MA
+#define PSU_LIMIT_MA 0 // no limit
+#endif
+
 #define UUID_MODE       "1C52000A-457C-4D3C-AABA-E6F207422A10"
 #define UUID_SPEED      "1C52000A-457C-4D3C-AABA-E6F207422A11"
 #define UUID_REVERSE    "1C52000A-457C-4D3C-AABA-E6F207422A12"
@@ -31,8 +51,37 @@
 #define UUID_FADE       "1C52000A-457C-4D3C-AABA-E6F207422A14"
 #define UUID_COUNT      "1C52000A-457C-4D3C-AABA-E6F207422A15"
 #define UUID_MODE_NAME  "1C52000A-457C-4D3C-AABA-E6F207422A16"
-
-ws2812_pixel_t *_colors;
+#define UUID_TRANSITION "1C52000A-457C-4D3C-AABA-E6F207422A17"
+#define UUID_FPS            "1C52000A-457C-4D3C-AABA-E6F207422A18"
+#define UUID_RENDER_AVG     "1C52000A-457C-4D3C-AABA-E6F207422A19"
+#define UUID_RENDER_MAX     "1C52000A-457C-4D3C-AABA-E6F207422A1A"
+#define UUID_WRITE_TIME     "1C52000A-457C-4D3C-AABA-E6F207422A1B"
+#define UUID_SKIPPED        "1C52000A-457C-4D3C-AABA-E6F207422A1C"
+#define UUID_FREE_HEAP      "1C52000A-457C-4D3C-AABA-E6F207422A1D"
+#define UUID_SAMPLED_MIN_HEAP "1C52000A-457C-4D3C-AABA-E6F207422A1E"
+#define UUID_STACK_FREE     "1C52000A-457C-4D3C-AABA-E6F207422A1F"
+#define UUID_BOOT_PHASES    "1C52000A-457C-4D3C-AABA-E6F207422A20"
+#define UUID_SCENE          "1C52000A-457C-4D3C-AABA-E6F207422A21"
+#define UUID_PRESET_STORE   "1C52000A-457C-4D3C-AABA-E6F207422A22"
+#define UUID_PRESET_RECALL  "1C52000A-457C-4D3C-AABA-E6F207422A23"
+#define UUID_CURRENT        "1C52000A-457C-4D3C-AABA-E6F207422A24"
+#define UUID_LIMITED        "1C52000A-457C-4D3C-AABA-E6F207422A25"
+#define UUID_AUDIO_ISR_TIME "1C52000A-457C-4D3C-AABA-E6F207422A26"
+#define UUID_TELEMETRY_STACK_FREE "1C52000A-457C-4D3C-AABA-E6F207422A27"
+
+#define TELEMETRY_INTERVAL_MS 10000
+#define HEAP_SAMPLE_INTERVAL_MS 1000
+#define TELEMETRY_STACK_SIZE 512 // words, homekit_characteristic_notify runs on it
+
+#define FIRST_LIGHT_BUDGET_US 100000 // reset to first frame on the strip
+
+#define STATE_RECORD_SIZE 64
+#define SAVE_DELAY_MS 5000 // quiet period before changes are written to flash
+
+#define SCENE_WRITE_SIZE 128 // flattened Scene write, room for fields added later
+
+#define PRESET_COUNT 8
+#define PRESET_RECORD_SIZE 256
 
 // Home Kit variables
 bool hk_on[]          = {true, true, true, true, true, true, true};
@@ -44,6 +93,7 @@ int hk_speed = 100;
 bool hk_reverse = false;
 int hk_density = 25;
 int hk_fade = 50;
+int hk_transition = 500;
 
 void identify_task(void *_args) {
     for (int i = 0; i < 3; i++) {
@@ -63,12 +113,8 @@ void identify(homekit_value_t _value) {
 }
 
 void updateColors() {
-    int color_count = 0;
-    for (int i = 0; i < 7; i++) {
-        if (hk_on[i]) color_count++;
-    }
-    ws2812_pixel_t *colors = (ws2812_pixel_t*) malloc(color_count * sizeof(ws2812_pixel_t));
-    
+    // ws2812_setColors copies, so the palette can live on the stack
+    ws2812_pixel_t colors[WS2812_MAX_COLORS];
     int color_idx = 0;
     for (int i = 0; i < 7; i++) {
         if (hk_on[i]) {
@@ -78,10 +124,127 @@ void updateColors() {
             color_idx++;
         }
     }
-    ws2812_pixel_t *old = _colors;
-    _colors = colors;
-    ws2812_setColors(color_count, _colors);
-    free(old);
+    ws2812_setColors(color_idx, colors);
+}
+
+storage_log_t state_log;
+TimerHandle_t save_timer;
+scene_t saved_scene;
+
+void sceneFromHomeKit(scene_t *scene) {
+    scene->on = 0;
+    for (int i = 0; i < SCENE_COLOR_COUNT; i++) {
+        if (hk_on[i]) scene->on |= 1 << i;
+        scene->hue[i] = roundf(hk_hue[i]);
+        scene->saturation[i] = roundf(hk_saturation[i]);
+    }
+    scene->brightness = hk_brightness;
+    scene->mode = hk_mode;
+    scene->speed = hk_speed;
+    scene->reverse = hk_reverse;
+    scene->density = hk_density;
+    scene->fade = hk_fade;
+    scene->transition = hk_transition;
+}
+
+void sceneToHomeKit(const scene_t *scene) {
+    for (int i = 0; i < SCENE_COLOR_COUNT; i++) {
+        hk_on[i] = scene->on & (1 << i);
+        hk_hue[i] = scene->hue[i];
+        hk_saturation[i] = scene->saturation[i];
+    }
+    hk_brightness = scene->brightness;
+    hk_mode = scene->mode;
+    hk_speed = scene->speed;
+    hk_reverse = scene->reverse;
+    hk_density = scene->density;
+    hk_fade = scene->fade;
+    hk_transition = scene->transition;
+}
+
+// push every hk_ variable to the strip, used after they change wholesale
+void applyHomeKit() {
+    ws2812_beginBatch();
+    updateColors();
+    ws2812_setBrightness(hk_brightness);
+    ws2812_setMode(hk_mode);
+    ws2812_setSpeed(hk_speed);
+    ws2812_setReverseDirection(hk_reverse);
+    ws2812_setDensity(hk_density);
+    ws2812_setFade(hk_fade);
+    ws2812_setTransition(hk_transition);
+    ws2812_commitBatch();
+    ws2812_on(hk_on[0]);
+}
+
+void save_callback(TimerHandle_t timer) {
+    scene_t scene;
+    sceneFromHomeKit(&scene);
+    if (memcmp(&scene, &saved_scene, sizeof(scene_t)) == 0) return;
+    if (storage_save(&state_log, &scene, sizeof(scene_t))) {
+        saved_scene = scene;
+        printf("state: saved: sequence: %u\n", state_log.sequence);
+    }
+    else {
+        printf("state: save failed\n");
+    }
+}
+
+void scheduleSave() {
+    // every change restarts the quiet period, so a slider drag is one write
+    xTimerReset(save_timer, 0);
+}
+
+// true when a saved scene was found, runs before first light so it doesn't log
+bool restoreState() {
+    storage_init(&state_log, STATE_SPI_FLASH_BASE_ADDR, STATE_RECORD_SIZE);
+    scene_t scene;
+    bool restored = storage_load(&state_log, &scene, sizeof(scene_t));
+    if (restored) sceneToHomeKit(&scene);
+    sceneFromHomeKit(&saved_scene);
+    save_timer = xTimerCreate("save", SAVE_DELAY_MS / portTICK_PERIOD_MS, pdFALSE, NULL, save_callback);
+    return restored;
+}
+
+// flash image of the preset slots
+typedef struct {
+    uint8_t valid; // bit per slot
+    scene_t scenes[PRESET_COUNT];
+} presets_t;
+
+storage_log_t preset_log;
+presets_t presets;
+// built when a slot is stored or loaded, so a recall only swaps a pointer
+ws2812_params_t preset_params[PRESET_COUNT];
+int hk_preset = 0;
+
+void presetBuild(int slot) {
+    const scene_t *scene = &presets.scenes[slot];
+    ws2812_pixel_t colors[WS2812_MAX_COLORS];
+    int color_count = 0;
+    for (int i = 0; i < SCENE_COLOR_COUNT; i++) {
+        if (scene->on & (1 << i)) {
+            ws2812_pixel_t color = {{ 0, 0, 0, 0 }};
+            hs2rgb(scene->hue[i], scene->saturation[i] / 100.0f, &color);
+            colors[color_count++] = color;
+        }
+    }
+    // the strip may be showing this slot, so it is built off to the side
+    ws2812_params_t params;
+    ws2812_initParams(&params, color_count, colors, scene->brightness,
+        scene->mode, scene->speed, scene->reverse, scene->density, scene->fade);
+    ws2812_storeParams(&preset_params[slot], &params);
+}
+
+void restorePresets() {
+    storage_init(&preset_log, PRESET_SPI_FLASH_BASE_ADDR, PRESET_RECORD_SIZE);
+    if (!storage_load(&preset_log, &presets, sizeof(presets_t))) {
+        presets.valid = 0;
+    }
+    for (int slot = 0; slot < PRESET_COUNT; slot++) {
+        if (presets.valid & (1 << slot)) presetBuild(slot);
+    }
+    printf("preset: restored: %02x\n", presets.valid);
 }
 
 int getColorIndex(const homekit_characteristic_t *ch) {
@@ -98,6 +261,7 @@ void led_on_set(homekit_characteristic_t *ch, const homekit_value_t value) {
     hk_on[index] = value.bool_value;
     if (index == 0) ws2812_on(value.bool_value);
     updateColors();
+    scheduleSave();
 }
 
 homekit_value_t led_brightness_get() {
@@ -107,6 +271,7 @@ homekit_value_t led_brightness_get() {
 void led_brightness_set(homekit_value_t value) {
     hk_brightness = value.int_value;
     ws2812_setBrightness(hk_brightness);
+    scheduleSave();
 }
 
 homekit_value_t led_hue_get(const homekit_characteristic_t *ch) {
@@ -118,6 +283,7 @@ void led_hue_set(homekit_characteristic_t *ch, const homekit_value_t value) {
     int index = getColorIndex(ch);
     hk_hue[index] = value.float_value;
     updateColors();
+    scheduleSave();
 }
 
 homekit_value_t led_saturation_get(const homekit_characteristic_t *ch) {
@@ -129,6 +295,7 @@ void led_saturation_set(homekit_characteristic_t *ch, const homekit_value_t valu
     int index = getColorIndex(ch);
     hk_saturation[index] = value.float_value;
     updateColors();
+    scheduleSave();
 }
 
 homekit_value_t led_mode_get() {
@@ -138,6 +305,7 @@ homekit_value_t led_mode_get() {
 void led_mode_set(homekit_value_t value) {
     hk_mode = value.int_value;
     ws2812_setMode(hk_mode);
+    scheduleSave();
 }
 
 homekit_value_t led_mode_name_get() {
@@ -164,6 +332,21 @@ homekit_value_t led_mode_name_get() {
         case MD_FIREWORKS: 
             name = "Fireworks";
             break;
+        case MD_PLASMA:
+            name = "Plasma";
+            break;
+        case MD_NOISE:
+            name = "Noise";
+            break;
+        case MD_GRADIENT:
+            name = "Gradient";
+            break;
+        case MD_SPECTRUM:
+            name = "Spectrum";
+            break;
+        case MD_PULSE:
+            name = "Pulse";
+            break;
         default: 
             name = "Ooopies";
     }
@@ -177,6 +360,7 @@ homekit_value_t led_speed_get() {
 void led_speed_set(homekit_value_t value) {
     hk_speed = value.int_value;
     ws2812_setSpeed(hk_speed);
+    scheduleSave();
 }
 
 homekit_value_t led_reverse_get() {
@@ -186,6 +370,7 @@ homekit_value_t led_reverse_get() {
 void led_reverse_set(homekit_value_t value) {
     hk_reverse = value.bool_value;
     ws2812_setReverseDirection(hk_reverse);
+    scheduleSave();
 }
 
 homekit_value_t led_density_get() {
@@ -195,6 +380,7 @@ homekit_value_t led_density_get() {
 void led_density_set(homekit_value_t value) {
     hk_density = value.int_value;
     ws2812_setDensity(hk_density);
+    scheduleSave();
 }
 
 homekit_value_t led_fade_get() {
@@ -204,6 +390,352 @@ homekit_value_t led_fade_get() {
 void led_fade_set(homekit_value_t value) {
     hk_fade = value.int_value;
     ws2812_setFade(hk_fade);
+    scheduleSave();
+}
+
+homekit_value_t led_transition_get() {
+    return HOMEKIT_INT(hk_transition);
+}
+
+void led_transition_set(homekit_value_t value) {
+    hk_transition = value.int_value;
+    ws2812_setTransition(hk_transition);
+    scheduleSave();
+}
+
+// named so changes made behind a controller's back (a Scene write, a preset
+// recall) can be notified, index 0 of the color arrays is the main light
+#define LED_ON HOMEKIT_CHARACTERISTIC_(ON, true, .getter_ex = led_on_get, .setter_ex = led_on_set)
+homekit_characteristic_t led_on[SCENE_COLOR_COUNT] = {
+    LED_ON, LED_ON, LED_ON, LED_ON, LED_ON, LED_ON, LED_ON
+};
+
+#define LED_HUE(_hue) HOMEKIT_CHARACTERISTIC_(HUE, _hue, .getter_ex = led_hue_get, .setter_ex = led_hue_set)
+homekit_characteristic_t led_hue[SCENE_COLOR_COUNT] = {
+    LED_HUE(0), LED_HUE(240), LED_HUE(120), LED_HUE(360), LED_HUE(180), LED_HUE(60), LED_HUE(300)
+};
+
+#define LED_SATURATION(_saturation) HOMEKIT_CHARACTERISTIC_(SATURATION, _saturation, .getter_ex = led_saturation_get, .setter_ex = led_saturation_set)
+homekit_characteristic_t led_saturation[SCENE_COLOR_COUNT] = {
+    LED_SATURATION(0), LED_SATURATION(100), LED_SATURATION(100), LED_SATURATION(100),
+    LED_SATURATION(100), LED_SATURATION(100), LED_SATURATION(100)
+};
+
+homekit_characteristic_t led_brightness = HOMEKIT_CHARACTERISTIC_(
+    BRIGHTNESS, 100,
+.getter = led_brightness_get,
+.setter = led_brightness_set
+    );
+
+homekit_characteristic_t led_mode = HOMEKIT_CHARACTERISTIC_(
+    CUSTOM,
+.type = UUID_MODE,
+.description = "FXMode",
+.format = homekit_format_int,
+.permissions = homekit_permissions_paired_read
+             | homekit_permissions_paired_write
+             | homekit_permissions_notify,
+.min_value = (float[]) {1},
+.max_value = (float[]) {MD_LAST},
+.min_step = (float[]) {1},
+.value = HOMEKIT_INT_(1),
+.getter = led_mode_get,
+.setter = led_mode_set
+    );
+
+homekit_characteristic_t led_speed = HOMEKIT_CHARACTERISTIC_(
+    CUSTOM,
+.type = UUID_SPEED,
+.description = "Speed",
+.format = homekit_format_int,
+.permissions = homekit_permissions_paired_read
+             | homekit_permissions_paired_write
+             | homekit_permissions_notify,
+.min_value = (float[]) {0},
+.max_value = (float[]) {100},
+.min_step = (float[]) {1},
+.value = HOMEKIT_INT_(100),
+.getter = led_speed_get,
+.setter = led_speed_set
+    );
+
+homekit_characteristic_t led_reverse = HOMEKIT_CHARACTERISTIC_(
+    CUSTOM,
+.type = UUID_REVERSE,
+.description = "Reverse",
+.format = homekit_format_bool,
+.permissions = homekit_permissions_paired_read
+             | homekit_permissions_paired_write
+             | homekit_permissions_notify,
+.value = HOMEKIT_BOOL_(false),
+.getter = led_reverse_get,
+.setter = led_reverse_set
+    );
+
+homekit_characteristic_t led_density = HOMEKIT_CHARACTERISTIC_(
+    CUSTOM,
+.type = UUID_DENSITY,
+.description = "Density",
+.format = homekit_format_int,
+.permissions = homekit_permissions_paired_read
+             | homekit_permissions_paired_write
+             | homekit_permissions_notify,
+.min_value = (float[]) {1},
+.max_value = (float[]) {100},
+.min_step = (float[]) {1},
+.value = HOMEKIT_INT_(25),
+.getter = led_density_get,
+.setter = led_density_set
+    );
+
+homekit_characteristic_t led_fade = HOMEKIT_CHARACTERISTIC_(
+    CUSTOM,
+.type = UUID_FADE,
+.description = "Fade",
+.format = homekit_format_int,
+.permissions = homekit_permissions_paired_read
+             | homekit_permissions_paired_write
+             | homekit_permissions_notify,
+.min_value = (float[]) {1},
+.max_value = (float[]) {100},
+.min_step = (float[]) {1},
+.value = HOMEKIT_INT_(50),
+.getter = led_fade_get,
+.setter = led_fade_set
+    );
+
+homekit_characteristic_t led_transition = HOMEKIT_CHARACTERISTIC_(
+    CUSTOM,
+.type = UUID_TRANSITION,
+.description = "Transition",
+.format = homekit_format_int,
+.permissions = homekit_permissions_paired_read
+             | homekit_permissions_paired_write
+             | homekit_permissions_notify,
+.min_value = (float[]) {0},
+.max_value = (float[]) {5000},
+.min_step = (float[]) {100},
+.value = HOMEKIT_INT_(500),
+.getter = led_transition_get,
+.setter = led_transition_set
+    );
+
+void notifyCharacteristic(homekit_characteristic_t *ch) {
+    homekit_value_t value = ch->getter_ex != NULL ? ch->getter_ex(ch) : ch->getter();
+    ch->value = value;
+    homekit_characteristic_notify(ch, value);
+}
+
+// notifies what differs from before now the hk_ variables changed wholesale,
+// each On reads through the main switch so it counts for all of them
+void notifyHomeKit(const scene_t *before) {
+    scene_t after;
+    sceneFromHomeKit(&after);
+    uint8_t on_changed = before->on ^ after.on;
+    for (int i = 0; i < SCENE_COLOR_COUNT; i++) {
+        if (on_changed & ((1 << i) | 1)) notifyCharacteristic(&led_on[i]);
+        if (before->hue[i] != after.hue[i]) notifyCharacteristic(&led_hue[i]);
+        if (before->saturation[i] != after.saturation[i]) notifyCharacteristic(&led_saturation[i]);
+    }
+    if (before->brightness != after.brightness) notifyCharacteristic(&led_brightness);
+    if (before->mode != after.mode) notifyCharacteristic(&led_mode);
+    if (before->speed != after.speed) notifyCharacteristic(&led_speed);
+    if (before->reverse != after.reverse) notifyCharacteristic(&led_reverse);
+    if (before->density != after.density) notifyCharacteristic(&led_density);
+    if (before->fade != after.fade) notifyCharacteristic(&led_fade);
+    if (before->transition != after.transition) notifyCharacteristic(&led_transition);
+}
+
+// The Scene characteristic is tlv8, esp-homekit moves it as a list of
+// entries and base64 on the wire. scene.c works on the flat TLV8 bytes.
+uint8_t scene_blob[SCENE_WRITE_SIZE];
+tlv_values_t scene_tlv_empty = { .head = NULL };
+tlv_values_t *scene_tlv = NULL; // last read, kept until the next one
+
+homekit_value_t led_scene_get() {
+    scene_t scene;
+    sceneFromHomeKit(&scene);
+    size_t size = scene_encode(&scene, scene_blob, sizeof(scene_blob));
+    if (scene_tlv != NULL) tlv_free(scene_tlv);
+    scene_tlv = tlv_new();
+    for (size_t pos = 0; pos < size; pos += 2 + scene_blob[pos + 1]) {
+        tlv_add_value(scene_tlv, scene_blob[pos], &scene_blob[pos + 2], scene_blob[pos + 1]);
+    }
+    return HOMEKIT_TLV(scene_tlv, .is_static=true);
+}
+
+// one write replaces the palette and every effect parameter, applied to the
+// strip in a single frame instead of passing through each intermediate state
+void led_scene_set(homekit_value_t value) {
+    if (value.format != homekit_format_tlv || value.tlv_values == NULL) return;
+    // back to TLV8 bytes, a value too long for one entry is none of ours
+    size_t size = 0;
+    for (tlv_t *entry = value.tlv_values->head; entry != NULL; entry = entry->next) {
+        if (entry->size > 255 || size + 2 + entry->size > sizeof(scene_blob)) {
+            printf("scene: rejected, over %d bytes\n", SCENE_WRITE_SIZE);
+            return;
+        }
+        scene_blob[size] = entry->type;
+        scene_blob[size + 1] = entry->size;
+        memcpy(&scene_blob[size + 2], entry->value, entry->size);
+        size += 2 + entry->size;
+    }
+    scene_t before, scene;
+    sceneFromHomeKit(&before);
+    scene = before;
+    if (!scene_decode(scene_blob, size, &scene)) {
+        printf("scene: rejected %d bytes\n", (int) size);
+        return;
+    }
+    sceneToHomeKit(&scene);
+    applyHomeKit();
+    notifyHomeKit(&before);
+    scheduleSave();
+}
+
+void led_preset_store_set(homekit_value_t value) {
+    int slot = value.int_value - 1;
+    if (slot < 0 || slot >= PRESET_COUNT) return;
+    sceneFromHomeKit(&presets.scenes[slot]);
+    presets.valid |= 1 << slot;
+    presetBuild(slot);
+    if (!storage_save(&preset_log, &presets, sizeof(presets_t))) {
+        printf("preset: save failed\n");
+    }
+    printf("preset: stored: %d\n", slot + 1);
+}
+
+homekit_value_t led_preset_recall_get() {
+    return HOMEKIT_INT(hk_preset);
+}
+
+void led_preset_recall_set(homekit_value_t value) {
+    int slot = value.int_value - 1;
+    if (slot < 0 || slot >= PRESET_COUNT || !(presets.valid & (1 << slot))) {
+        printf("preset: nothing stored in: %d\n", value.int_value);
+        return;
+    }
+    hk_preset = slot + 1;
+    scene_t before;
+    sceneFromHomeKit(&before);
+    sceneToHomeKit(&presets.scenes[slot]);
+    ws2812_recallParams(&preset_params[slot]);
+    ws2812_setTransition(hk_transition);
+    ws2812_on(hk_on[0]);
+    notifyHomeKit(&before);
+    scheduleSave();
+}
+
+// sdk_system_get_time() at each step of startup, in us since reset
+enum {
+    BOOT_INIT,
+    BOOT_RESTORED,
+    BOOT_FIRST_LIGHT,
+    BOOT_WIFI_INIT,
+    BOOT_HOMEKIT_INIT,
+    BOOT_WIFI_READY,
+    BOOT_PHASE_COUNT
+};
+uint32_t boot_times[BOOT_PHASE_COUNT];
+char boot_phases[64] = "";
+
+void bootPhase(int phase) {
+    boot_times[phase] = sdk_system_get_time();
+}
+
+#define TELEMETRY_CHARACTERISTIC(_type, _description, _format, _value) \
+    HOMEKIT_CHARACTERISTIC_( \
+        CUSTOM, \
+    .type = _type, \
+    .description = _description, \
+    .format = _format, \
+    .permissions = homekit_permissions_paired_read \
+                 | homekit_permissions_notify, \
+    .value = _value, \
+        )
+
+homekit_characteristic_t telemetry_fps = TELEMETRY_CHARACTERISTIC(UUID_FPS, "FPS", homekit_format_float, HOMEKIT_FLOAT_(0));
+homekit_characteristic_t telemetry_render_avg = TELEMETRY_CHARACTERISTIC(UUID_RENDER_AVG, "RenderTimeAvg", homekit_format_uint32, HOMEKIT_UINT32_(0));
+homekit_characteristic_t telemetry_render_max = TELEMETRY_CHARACTERISTIC(UUID_RENDER_MAX, "RenderTimeMax", homekit_format_uint32, HOMEKIT_UINT32_(0));
+homekit_characteristic_t telemetry_write_time = TELEMETRY_CHARACTERISTIC(UUID_WRITE_TIME, "WriteTime", homekit_format_uint32, HOMEKIT_UINT32_(0));
+homekit_characteristic_t telemetry_skipped = TELEMETRY_CHARACTERISTIC(UUID_SKIPPED, "SkippedFrames", homekit_format_uint32, HOMEKIT_UINT32_(0));
+homekit_characteristic_t telemetry_free_heap = TELEMETRY_CHARACTERISTIC(UUID_FREE_HEAP, "FreeHeap", homekit_format_uint32, HOMEKIT_UINT32_(0));
+homekit_characteristic_t telemetry_sampled_min_heap = TELEMETRY_CHARACTERISTIC(UUID_SAMPLED_MIN_HEAP, "SampledMinFreeHeap", homekit_format_uint32, HOMEKIT_UINT32_(0));
+homekit_characteristic_t telemetry_stack_free = TELEMETRY_CHARACTERISTIC(UUID_STACK_FREE, "StackFree", homekit_format_uint32, HOMEKIT_UINT32_(0));
+homekit_characteristic_t telemetry_current = TELEMETRY_CHARACTERISTIC(UUID_CURRENT, "CurrentEstimate", homekit_format_uint32, HOMEKIT_UINT32_(0));
+homekit_characteristic_t telemetry_limited = TELEMETRY_CHARACTERISTIC(UUID_LIMITED, "LimitedFrames", homekit_format_uint32, HOMEKIT_UINT32_(0));
+homekit_characteristic_t telemetry_audio_isr_time = TELEMETRY_CHARACTERISTIC(UUID_AUDIO_ISR_TIME, "AudioIsrTimeMax", homekit_format_uint32, HOMEKIT_UINT32_(0));
+homekit_characteristic_t telemetry_stack_free_self = TELEMETRY_CHARACTERISTIC(UUID_TELEMETRY_STACK_FREE, "TelemetryStackFree", homekit_format_uint32, HOMEKIT_UINT32_(0));
+homekit_characteristic_t telemetry_boot_phases = TELEMETRY_CHARACTERISTIC(UUID_BOOT_PHASES, "BootPhases", homekit_format_string, HOMEKIT_STRING_(boot_phases, .is_static=true));
+
+void telemetry_notify(homekit_characteristic_t *ch, homekit_value_t value) {
+    if (homekit_value_equal(&ch->value, &value)) return;
+    ch->value = value;
+    homekit_characteristic_notify(ch, value);
+}
+
+// decimal value and a separator, instead of pulling snprintf onto the
+// telemetry stack
+char *appendUint(char *p, uint32_t value, char separator) {
+    char digits[10];
+    int count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) *p++ = digits[--count];
+    *p++ = separator;
+    return p;
+}
+
+void telemetry_task(void *_args) {
+    uint32_t skipped = 0;
+    uint32_t limited = 0;
+    uint32_t free_heap = xPortGetFreeHeapSize();
+    uint32_t sampled_min_heap = free_heap;
+    ws2812_stats_t stats;
+
+    while (true) {
+        // lowest of the samples, not the lowest ever, a short lived
+        // allocation between two samples doesn't show up
+        for (int i = 0; i < TELEMETRY_INTERVAL_MS / HEAP_SAMPLE_INTERVAL_MS; i++) {
+            vTaskDelay(HEAP_SAMPLE_INTERVAL_MS / portTICK_PERIOD_MS);
+            free_heap = xPortGetFreeHeapSize();
+            if (free_heap < sampled_min_heap) sampled_min_heap = free_heap;
+        }
+
+        ws2812_getStats(&stats);
+        skipped += stats.skipped_frames;
+        limited += stats.limited_frames;
+
+        float fps = stats.window > 0 ? stats.frames * 1000.0f / stats.window : 0;
+        telemetry_notify(&telemetry_fps, HOMEKIT_FLOAT(roundf(fps * 10) / 10));
+        telemetry_notify(&telemetry_render_avg, HOMEKIT_UINT32(stats.render_time_avg));
+        telemetry_notify(&telemetry_render_max, HOMEKIT_UINT32(stats.render_time_max));
+        telemetry_notify(&telemetry_write_time, HOMEKIT_UINT32(stats.write_time_avg));
+        telemetry_notify(&telemetry_skipped, HOMEKIT_UINT32(skipped));
+        telemetry_notify(&telemetry_free_heap, HOMEKIT_UINT32(free_heap));
+        telemetry_notify(&telemetry_sampled_min_heap, HOMEKIT_UINT32(sampled_min_heap));
+        telemetry_notify(&telemetry_stack_free, HOMEKIT_UINT32(stats.stack_free));
+        telemetry_notify(&telemetry_current, HOMEKIT_UINT32(stats.current));
+        telemetry_notify(&telemetry_limited, HOMEKIT_UINT32(limited));
+        telemetry_notify(&telemetry_audio_isr_time, HOMEKIT_UINT32(audio_takeIsrTimeMax()));
+
+        // ms after reset: user_init, restored state, first light, wifi and homekit init, wifi ready
+        char phases[sizeof(boot_phases)];
+        char *p = phases;
+        for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+            p = appendUint(p, boot_times[i] / 1000, i + 1 < BOOT_PHASE_COUNT ? ' ' : '\0');
+        }
+        if (strcmp(phases, boot_phases) != 0) {
+            // the characteristic points at boot_phases, so compare before copying
+            strcpy(boot_phases, phases);
+            homekit_characteristic_notify(&telemetry_boot_phases, telemetry_boot_phases.value);
+        }
+
+        // words never touched since the task started, after a full round of notifies
+        telemetry_notify(&telemetry_stack_free_self, HOMEKIT_UINT32(uxTaskGetStackHighWaterMark(NULL)));
+    }
 }
 
 homekit_characteristic_t name = HOMEKIT_CHARACTERISTIC_(NAME, HOMEKIT_NAME);
@@ -211,126 +743,54 @@ homekit_characteristic_t name = HOMEKIT_CHARACTERISTIC_(NAME, HOMEKIT_NAME);
 homekit_service_t color_2 = 
     HOMEKIT_SERVICE_(LIGHTBULB, .id = 2, .primary = false, .characteristics = (homekit_characteristic_t*[]) {
         HOMEKIT_CHARACTERISTIC(NAME, "Color-2"),
-        HOMEKIT_CHARACTERISTIC(
-            ON, true,
-        .getter_ex = led_on_get,
-        .setter_ex = led_on_set
-            ),
-        HOMEKIT_CHARACTERISTIC(
-            HUE, 240,
-        .getter_ex = led_hue_get,
-        .setter_ex = led_hue_set
-            ),
-        HOMEKIT_CHARACTERISTIC(
-            SATURATION, 100,
-        .getter_ex = led_saturation_get,
-        .setter_ex = led_saturation_set
-            ),
+        &led_on[1],
+        &led_hue[1],
+        &led_saturation[1],
         NULL
     });
     
 homekit_service_t color_3 = 
     HOMEKIT_SERVICE_(LIGHTBULB, .id = 3, .primary = false, .characteristics = (homekit_characteristic_t*[]) {
         HOMEKIT_CHARACTERISTIC(NAME, "Color-3"),
-        HOMEKIT_CHARACTERISTIC(
-            ON, true,
-        .getter_ex = led_on_get,
-        .setter_ex = led_on_set
-            ),
-        HOMEKIT_CHARACTERISTIC(
-            HUE, 120,
-        .getter_ex = led_hue_get,
-        .setter_ex = led_hue_set
-            ),
-        HOMEKIT_CHARACTERISTIC(
-            SATURATION, 100,
-        .getter_ex = led_saturation_get,
-        .setter_ex = led_saturation_set
-            ),
+        &led_on[2],
+        &led_hue[2],
+        &led_saturation[2],
         NULL
     });
     
 homekit_service_t color_4 = 
     HOMEKIT_SERVICE_(LIGHTBULB, .id = 4, .primary = false, .characteristics = (homekit_characteristic_t*[]) {
         HOMEKIT_CHARACTERISTIC(NAME, "Color-4"),
-        HOMEKIT_CHARACTERISTIC(
-            ON, true,
-        .getter_ex = led_on_get,
-        .setter_ex = led_on_set
-            ),
-        HOMEKIT_CHARACTERISTIC(
-            HUE, 360,
-        .getter_ex = led_hue_get,
-        .setter_ex = led_hue_set
-            ),
-        HOMEKIT_CHARACTERISTIC(
-            SATURATION, 100,
-        .getter_ex = led_saturation_get,
-        .setter_ex = led_saturation_set
-            ),
+        &led_on[3],
+        &led_hue[3],
+        &led_saturation[3],
         NULL
     });
     
 homekit_service_t color_5 = 
     HOMEKIT_SERVICE_(LIGHTBULB, .id = 5, .primary = false, .characteristics = (homekit_characteristic_t*[]) {
         HOMEKIT_CHARACTERISTIC(NAME, "Color-5"),
-        HOMEKIT_CHARACTERISTIC(
-            ON, true,
-        .getter_ex = led_on_get,
-        .setter_ex = led_on_set
-            ),
-        HOMEKIT_CHARACTERISTIC(
-            HUE, 180,
-        .getter_ex = led_hue_get,
-        .setter_ex = led_hue_set
-            ),
-        HOMEKIT_CHARACTERISTIC(
-            SATURATION, 100,
-        .getter_ex = led_saturation_get,
-        .setter_ex = led_saturation_set
-            ),
+        &led_on[4],
+        &led_hue[4],
+        &led_saturation[4],
         NULL
     });
     
 homekit_service_t color_6 = 
     HOMEKIT_SERVICE_(LIGHTBULB, .id = 6, .primary = false, .characteristics = (homekit_characteristic_t*[]) {
         HOMEKIT_CHARACTERISTIC(NAME, "Color-6"),
-        HOMEKIT_CHARACTERISTIC(
-            ON, true,
-        .getter_ex = led_on_get,
-        .setter_ex = led_on_set
-            ),
-        HOMEKIT_CHARACTERISTIC(
-            HUE, 60,
-        .getter_ex = led_hue_get,
-        .setter_ex = led_hue_set
-            ),
-        HOMEKIT_CHARACTERISTIC(
-            SATURATION, 100,
-        .getter_ex = led_saturation_get,
-        .setter_ex = led_saturation_set
-            ),
+        &led_on[5],
+        &led_hue[5],
+        &led_saturation[5],
         NULL
     });
 
 homekit_service_t color_7 = 
     HOMEKIT_SERVICE_(LIGHTBULB, .id = 7, .primary = false, .characteristics = (homekit_characteristic_t*[]) {
         HOMEKIT_CHARACTERISTIC(NAME, "Color-7"),
-        HOMEKIT_CHARACTERISTIC(
-            ON, true,
-        .getter_ex = led_on_get,
-        .setter_ex = led_on_set
-            ),
-        HOMEKIT_CHARACTERISTIC(
-            HUE, 300,
-        .getter_ex = led_hue_get,
-        .setter_ex = led_hue_set
-            ),
-        HOMEKIT_CHARACTERISTIC(
-            SATURATION, 100,
-        .getter_ex = led_saturation_get,
-        .setter_ex = led_saturation_set
-            ),
+        &led_on[6],
+        &led_hue[6],
+        &led_saturation[6],
         NULL
     });
 
@@ -353,40 +813,11 @@ homekit_accessory_t *accessories[] = {
             .primary = true,
             .characteristics = (homekit_characteristic_t*[]) {
             HOMEKIT_CHARACTERISTIC(NAME, HOMEKIT_NAME),
-            HOMEKIT_CHARACTERISTIC(
-                ON, true,
-            .getter_ex = led_on_get,
-            .setter_ex = led_on_set
-                ),
-            HOMEKIT_CHARACTERISTIC(
-                BRIGHTNESS, 100,
-            .getter = led_brightness_get,
-            .setter = led_brightness_set
-                ),
-            HOMEKIT_CHARACTERISTIC(
-                HUE, 0,
-            .getter_ex = led_hue_get,
-            .setter_ex = led_hue_set
-                ),
-            HOMEKIT_CHARACTERISTIC(
-                SATURATION, 0,
-            .getter_ex = led_saturation_get,
-            .setter_ex = led_saturation_set
-                ),
-            HOMEKIT_CHARACTERISTIC(
-                CUSTOM,
-            .type = UUID_MODE,
-            .description = "FXMode",
-            .format = homekit_format_int,
-            .permissions = homekit_permissions_paired_read
-                         | homekit_permissions_paired_write,
-            .min_value = (float[]) {1},
-            .max_value = (float[]) {7},
-            .min_step = (float[]) {1},
-            .value = HOMEKIT_INT_(1),
-            .getter = led_mode_get,
-            .setter = led_mode_set
-                ),
+            &led_on[0],
+            &led_brightness,
+            &led_hue[0],
+            &led_saturation[0],
+            &led_mode,
             HOMEKIT_CHARACTERISTIC(
                 CUSTOM,
             .type = UUID_MODE_NAME,
@@ -396,58 +827,47 @@ homekit_accessory_t *accessories[] = {
             .value = HOMEKIT_STRING_("Init", .is_static=true),
             .getter = led_mode_name_get
                 ),
+            &led_speed,
+            &led_reverse,
+            &led_density,
+            &led_fade,
+            &led_transition,
             HOMEKIT_CHARACTERISTIC(
                 CUSTOM,
-            .type = UUID_SPEED,
-            .description = "Speed",
-            .format = homekit_format_int,
-            .permissions = homekit_permissions_paired_read
-                         | homekit_permissions_paired_write,
-            .min_value = (float[]) {0},
-            .max_value = (float[]) {100},
-            .min_step = (float[]) {1},
-            .value = HOMEKIT_INT_(100),
-            .getter = led_speed_get,
-            .setter = led_speed_set
-                ),
-            HOMEKIT_CHARACTERISTIC(
-                CUSTOM,
-            .type = UUID_REVERSE,
-            .description = "Reverse",
-            .format = homekit_format_bool,
+            .type = UUID_SCENE,
+            .description = "Scene",
+            .format = homekit_format_tlv,
             .permissions = homekit_permissions_paired_read
                          | homekit_permissions_paired_write,
-            .value = HOMEKIT_BOOL_(false),
-            .getter = led_reverse_get,
-            .setter = led_reverse_set
+            .value = HOMEKIT_TLV_(&scene_tlv_empty, .is_static=true),
+            .getter = led_scene_get,
+            .setter = led_scene_set
                 ),
             HOMEKIT_CHARACTERISTIC(
                 CUSTOM,
-            .type = UUID_DENSITY,
-            .description = "Density",
+            .type = UUID_PRESET_STORE,
+            .description = "PresetStore",
             .format = homekit_format_int,
-            .permissions = homekit_permissions_paired_read
-                         | homekit_permissions_paired_write,
+            .permissions = homekit_permissions_paired_write,
             .min_value = (float[]) {1},
-            .max_value = (float[]) {100},
+            .max_value = (float[]) {PRESET_COUNT},
             .min_step = (float[]) {1},
-            .value = HOMEKIT_INT_(25),
-            .getter = led_density_get,
-            .setter = led_density_set
+            .value = HOMEKIT_INT_(1),
+            .setter = led_preset_store_set
                 ),
             HOMEKIT_CHARACTERISTIC(
                 CUSTOM,
-            .type = UUID_FADE,
-            .description = "Fade",
+            .type = UUID_PRESET_RECALL,
+            .description = "PresetRecall",
             .format = homekit_format_int,
             .permissions = homekit_permissions_paired_read
                          | homekit_permissions_paired_write,
-            .min_value = (float[]) {1},
-            .max_value = (float[]) {100},
+            .min_value = (float[]) {0},
+            .max_value = (float[]) {PRESET_COUNT},
             .min_step = (float[]) {1},
-            .value = HOMEKIT_INT_(50),
-            .getter = led_fade_get,
-            .setter = led_fade_set
+            .value = HOMEKIT_INT_(0),
+            .getter = led_preset_recall_get,
+            .setter = led_preset_recall_set
                 ),
             HOMEKIT_CHARACTERISTIC(
                 CUSTOM,
@@ -455,8 +875,21 @@ homekit_accessory_t *accessories[] = {
             .description = "LEDCount",
             .format = homekit_format_int,
             .permissions = homekit_permissions_paired_read,
-            .value = HOMEKIT_INT_(LED_COUNT),
+            .value = HOMEKIT_INT_(LED_TOTAL_COUNT),
                 ),
+            &telemetry_fps,
+            &telemetry_render_avg,
+            &telemetry_render_max,
+            &telemetry_write_time,
+            &telemetry_skipped,
+            &telemetry_free_heap,
+            &telemetry_sampled_min_heap,
+            &telemetry_stack_free,
+            &telemetry_current,
+            &telemetry_limited,
+            &telemetry_audio_isr_time,
+            &telemetry_boot_phases,
+            &telemetry_stack_free_self,
             NULL
         },
         .linked = (homekit_service_t*[]) {
@@ -494,16 +927,38 @@ homekit_server_config_t config = {
 };
 
 void on_wifi_ready() {
+    if (boot_times[BOOT_WIFI_READY] == 0) bootPhase(BOOT_WIFI_READY);
     identify(HOMEKIT_INT(1));    
 }
 
 void user_init(void) {
+    bootPhase(BOOT_INIT);
     gpio_enable(LED_INBUILT_GPIO, GPIO_OUTPUT);
 
-    updateColors();
-    ws2812_init(LED_COUNT, LED_ORDER_TYPE);
+    // light the strip with the saved scene before the network stack starts,
+    // ws2812_init sends the first frame before returning
+    bool restored = restoreState();
+    applyHomeKit();
+    bootPhase(BOOT_RESTORED);
+    audio_init(audio_source_adc());
+    ws2812_setPowerBudget(LED_MA_PER_CHANNEL, PSU_LIMIT_MA);
+    ws2812_output_t *outputs[] = {
+        ws2812_output_i2s(LED_COUNT, LED_ORDER_TYPE),
+#if LED2_COUNT > 0
+        ws2812_output_bitbang(LED2_COUNT, LED2_ORDER_TYPE, LED2_GPIO),
+#endif
+    };
+    ws2812_init(sizeof(outputs) / sizeof(outputs[0]), outputs);
+    bootPhase(BOOT_FIRST_LIGHT);
+    // everything up to here stays off the UART, this line stands in for it
+    printf("boot: first light took %uus%s, state: %s, sequence: %u\n", boot_times[BOOT_FIRST_LIGHT],
+        boot_times[BOOT_FIRST_LIGHT] > FIRST_LIGHT_BUDGET_US ? " (over budget)" : "",
+        restored ? "restored" : "defaults", state_log.sequence);
+
+    restorePresets();
 
     wifi_config_init(HOMEKIT_NAME, NULL, on_wifi_ready);
+    bootPhase(BOOT_WIFI_INIT);
 
     uint8_t macaddr[6];
     sdk_wifi_get_macaddr(STATION_IF, macaddr);
@@ -513,4 +968,7 @@ void user_init(void) {
     name.value = HOMEKIT_STRING(name_value);
 
     homekit_server_init(&config);
+    bootPhase(BOOT_HOMEKIT_INIT);
+
+    xTaskCreate(telemetry_task, "telemetry", TELEMETRY_STACK_SIZE, NULL, 1, NULL);
 }
@@ -0,0 +1,127 @@
+#include "scene.h"
+
+#include "ws2812.h"
+
+static uint8_t *put(uint8_t *data, uint8_t type, uint8_t length) {
+	data[0] = type;
+	data[1] = length;
+	return data + 2;
+}
+
+static uint8_t *put_byte(uint8_t *data, uint8_t type, uint8_t value) {
+	data = put(data, type, 1);
+	*data = value;
+	return data + 1;
+}
+
+size_t scene_encode(const scene_t *scene, uint8_t *data, size_t size) {
+	if (size < SCENE_BLOB_SIZE) return 0;
+
+	uint8_t *p = data;
+	p = put_byte(p, SCENE_TLV_VERSION, SCENE_VERSION);
+	p = put(p, SCENE_TLV_COLOR, SCENE_COLOR_COUNT * SCENE_COLOR_SIZE);
+	for (int i = 0; i < SCENE_COLOR_COUNT; i++) {
+		p[0] = i;
+		p[1] = scene->hue[i] & 0xFF;
+		p[2] = scene->hue[i] >> 8;
+		p[3] = scene->saturation[i];
+		p += SCENE_COLOR_SIZE;
+	}
+	p = put_byte(p, SCENE_TLV_ON, scene->on);
+	p = put_byte(p, SCENE_TLV_BRIGHTNESS, scene->brightness);
+	p = put_byte(p, SCENE_TLV_MODE, scene->mode);
+	p = put_byte(p, SCENE_TLV_SPEED, scene->speed);
+	p = put_byte(p, SCENE_TLV_REVERSE, scene->reverse);
+	p = put_byte(p, SCENE_TLV_DENSITY, scene->density);
+	p = put_byte(p, SCENE_TLV_FADE, scene->fade);
+	p = put(p, SCENE_TLV_TRANSITION, 2);
+	p[0] = scene->transition & 0xFF;
+	p[1] = scene->transition >> 8;
+	p += 2;
+	return p - data;
+}
+
+static bool in_range(int value, int min, int max) {
+	return value >= min && value <= max;
+}
+
+bool scene_decode(const uint8_t *data, size_t size, scene_t *scene) {
+	// decode into a copy so a bad entry late in the blob changes nothing
+	scene_t decoded = *scene;
+	bool versioned = false;
+	size_t pos = 0;
+	while (pos < size) {
+		if (size - pos < 2) return false;
+		uint8_t type = data[pos];
+		uint8_t length = data[pos + 1];
+		const uint8_t *value = &data[pos + 2];
+		pos += 2;
+		if (size - pos < length) return false;
+		pos += length;
+
+		if (type == SCENE_TLV_COLOR) {
+			if (length == 0 || length % SCENE_COLOR_SIZE != 0) return false;
+		}
+		else if (type <= SCENE_TLV_TRANSITION && length != (type == SCENE_TLV_TRANSITION ? 2 : 1)) {
+			return false;
+		}
+
+		switch (type) {
+			case SCENE_TLV_VERSION:
+				if (value[0] != SCENE_VERSION) return false;
+				versioned = true;
+				break;
+			case SCENE_TLV_COLOR:
+				for (int i = 0; i < length; i += SCENE_COLOR_SIZE) {
+					const uint8_t *color = &value[i];
+					int hue = color[1] | (color[2] << 8);
+					if (color[0] >= SCENE_COLOR_COUNT || hue > 360 || color[3] > 100) return false;
+					decoded.hue[color[0]] = hue;
+					decoded.saturation[color[0]] = color[3];
+				}
+				break;
+			case SCENE_TLV_ON:
+				if (value[0] >> SCENE_COLOR_COUNT) return false;
+				decoded.on = value[0];
+				break;
+			case SCENE_TLV_BRIGHTNESS:
+				if (!in_range(value[0], 0, 100)) return false;
+				decoded.brightness = value[0];
+				break;
+			case SCENE_TLV_MODE:
+				if (!in_range(value[0], MD_SOLID, MD_LAST)) return false;
+				decoded.mode = value[0];
+				break;
+			case SCENE_TLV_SPEED:
+				if (!in_range(value[0], 0, 100)) return false;
+				decoded.speed = value[0];
+				break;
+			case SCENE_TLV_REVERSE:
+				if (value[0] > 1) return false;
+				decoded.reverse = value[0];
+				break;
+			case SCENE_TLV_DENSITY:
+				if (!in_range(value[0], 1, 100)) return false;
+				decoded.density = value[0];
+				break;
+			case SCENE_TLV_FADE:
+				if (!in_range(value[0], 1, 100)) return false;
+				decoded.fade = value[0];
+				break;
+			case SCENE_TLV_TRANSITION: {
+				int transition = value[0] | (value[1] << 8);
+				if (transition > 5000) return false;
+				decoded.transition = transition;
+				break;
+			}
+			default:
+				// newer field, skip it
+				break;
+		}
+	}
+	// fields of another version may mean something else, so nothing
+	// applies without the version entry, wherever it came
+	if (!versioned) return false;
+	*scene = decoded;
+	return true;
+}
@@ -0,0 +1,53 @@
+#ifndef scene_h
+#define scene_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCENE_COLOR_COUNT 7
+
+// everything a user can set from HomeKit, packed for flash
+typedef struct {
+	uint8_t on;                             // bit per color, bit 0 is the main switch
+	uint8_t saturation[SCENE_COLOR_COUNT];  // 0 - 100
+	uint16_t hue[SCENE_COLOR_COUNT];        // 0 - 360
+	uint8_t brightness;
+	uint8_t mode;
+	uint8_t speed;
+	uint8_t reverse;
+	uint8_t density;
+	uint8_t fade;
+	uint16_t transition;                    // ms
+} scene_t;
+
+// Scene blob: TLV8 entries (type, length, value), the format of a HomeKit
+// tlv8 characteristic. A version entry must be present, multi-byte values
+// are little endian and unknown types are skipped. Consecutive entries of
+// one type are a single value split up in TLV8, so a color entry carries
+// any number of colors and the encoder never repeats a type.
+#define SCENE_VERSION           1
+#define SCENE_TLV_VERSION       0
+#define SCENE_TLV_COLOR         1 // per color: index, hue (2), saturation
+#define SCENE_TLV_ON            2 // bit per color like scene_t.on
+#define SCENE_TLV_BRIGHTNESS    3
+#define SCENE_TLV_MODE          4
+#define SCENE_TLV_SPEED         5
+#define SCENE_TLV_REVERSE       6
+#define SCENE_TLV_DENSITY       7
+#define SCENE_TLV_FADE          8
+#define SCENE_TLV_TRANSITION    9 // ms (2)
+
+#define SCENE_COLOR_SIZE 4
+
+// every field of a scene_t encoded
+#define SCENE_BLOB_SIZE (3 + 2 + SCENE_COLOR_COUNT * SCENE_COLOR_SIZE + 7 * 3 + 4)
+
+// writes the whole scene, returns the blob length or 0 if size is too small
+size_t scene_encode(const scene_t *scene, uint8_t *data, size_t size);
+
+// overlays the fields present in data onto scene, leaves scene untouched and
+// returns false if anything is malformed or out of range
+bool scene_decode(const uint8_t *data, size_t size, scene_t *scene);
+
+#endif
@@ -0,0 +1,120 @@
+#include "storage.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <spiflash.h>
+
+#define STORAGE_MAGIC 0x57533132 // "WS12"
+#define STORAGE_LOG_SIZE (2 * STORAGE_SECTOR_SIZE)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t sequence;
+	uint16_t size;
+	uint16_t crc;
+} record_header_t;
+
+// CRC-16/CCITT
+static uint16_t storage_crc(uint16_t crc, const uint8_t *data, uint16_t size) {
+	for (int i = 0; i < size; i++) {
+		crc ^= data[i] << 8;
+		for (int b = 0; b < 8; b++) {
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+static uint16_t record_crc(const record_header_t *header, const uint8_t *data) {
+	uint16_t crc = storage_crc(0xFFFF, (const uint8_t*) &header->sequence, sizeof(header->sequence));
+	crc = storage_crc(crc, (const uint8_t*) &header->size, sizeof(header->size));
+	return storage_crc(crc, data, header->size);
+}
+
+static bool record_read(storage_log_t *log, uint32_t addr, record_header_t *header, uint8_t *data) {
+	if (!spiflash_read(addr, (uint8_t*) header, sizeof(record_header_t))) return false;
+	if (header->magic != STORAGE_MAGIC) return false;
+	if (header->size > log->record_size - sizeof(record_header_t)) return false;
+	if (!spiflash_read(addr + sizeof(record_header_t), data, header->size)) return false;
+	return header->crc == record_crc(header, data);
+}
+
+static bool record_blank(storage_log_t *log, uint32_t addr) {
+	uint32_t word;
+	for (uint32_t offset = 0; offset < log->record_size; offset += sizeof(word)) {
+		if (!spiflash_read(addr + offset, (uint8_t*) &word, sizeof(word))) return false;
+		if (word != 0xFFFFFFFF) return false;
+	}
+	return true;
+}
+
+static uint32_t record_next(storage_log_t *log, uint32_t addr) {
+	addr += log->record_size;
+	if (addr >= log->base_addr + STORAGE_LOG_SIZE) addr = log->base_addr;
+	return addr;
+}
+
+void storage_init(storage_log_t *log, uint32_t base_addr, uint16_t record_size) {
+	log->base_addr = base_addr;
+	log->record_size = record_size;
+	log->next_addr = base_addr;
+	log->sequence = 0;
+
+	record_header_t header;
+	uint8_t data[record_size];
+	bool found = false;
+	for (uint32_t addr = base_addr; addr < base_addr + STORAGE_LOG_SIZE; addr += record_size) {
+		if (record_read(log, addr, &header, data) && (!found || header.sequence > log->sequence)) {
+			found = true;
+			log->sequence = header.sequence;
+			log->next_addr = record_next(log, addr);
+		}
+	}
+}
+
+bool storage_load(storage_log_t *log, void *data, uint16_t size) {
+	if (log->sequence == 0) return false;
+
+	uint32_t addr = log->next_addr == log->base_addr
+		? log->base_addr + STORAGE_LOG_SIZE - log->record_size
+		: log->next_addr - log->record_size;
+	record_header_t header;
+	uint8_t record[log->record_size];
+	if (!record_read(log, addr, &header, record) || header.size != size) {
+		printf("storage: load: no usable record at %08x\n", addr);
+		return false;
+	}
+	memcpy(data, record, size);
+	return true;
+}
+
+bool storage_save(storage_log_t *log, const void *data, uint16_t size) {
+	if (size > log->record_size - sizeof(record_header_t)) return false;
+
+	// skip slots left dirty by an interrupted write, erase when entering a sector
+	uint32_t addr = log->next_addr;
+	while (true) {
+		if ((addr - log->base_addr) % STORAGE_SECTOR_SIZE == 0) {
+			if (!spiflash_erase_sector(addr)) return false;
+			break;
+		}
+		if (record_blank(log, addr)) break;
+		addr = record_next(log, addr);
+	}
+
+	uint32_t buffer[log->record_size / sizeof(uint32_t)];
+	uint8_t *record = (uint8_t*) buffer;
+	record_header_t *header = (record_header_t*) buffer;
+	header->magic = STORAGE_MAGIC;
+	header->sequence = log->sequence + 1;
+	header->size = size;
+	memcpy(record + sizeof(record_header_t), data, size);
+	header->crc = record_crc(header, record + sizeof(record_header_t));
+
+	uint16_t length = (sizeof(record_header_t) + size + 3) & ~3;
+	if (!spiflash_write(addr, record, length)) return false;
+
+	log->sequence = header->sequence;
+	log->next_addr = record_next(log, addr);
+	return true;
+}
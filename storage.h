@@ -0,0 +1,27 @@
+#ifndef storage_h
+#define storage_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STORAGE_SECTOR_SIZE 4096
+
+// Append-only record log over two flash sectors. Every save goes to the next
+// blank slot, a sector is only erased when the log wraps into it, and the
+// record with the highest sequence number and a good crc wins on load, so a
+// write cut short by power loss falls back to the previous record.
+typedef struct {
+	uint32_t base_addr;     // two sectors starting here
+	uint16_t record_size;   // header included, multiple of 4 dividing STORAGE_SECTOR_SIZE
+	uint32_t next_addr;
+	uint32_t sequence;
+} storage_log_t;
+
+// scans the log for the latest record and where the next one goes
+void storage_init(storage_log_t *log, uint32_t base_addr, uint16_t record_size);
+
+bool storage_load(storage_log_t *log, void *data, uint16_t size);
+
+bool storage_save(storage_log_t *log, const void *data, uint16_t size);
+
+#endif
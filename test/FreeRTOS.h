@@ -0,0 +1,15 @@
+#ifndef FreeRTOS_h
+#define FreeRTOS_h
+
+#include <stdint.h>
+
+// the slice of FreeRTOS the host tests need, scheduled by sim.c
+typedef uint32_t TickType_t;
+typedef uint32_t UBaseType_t;
+typedef int32_t BaseType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define portTICK_PERIOD_MS 10 // esp-open-rtos runs at 100Hz
+#define pdPASS 1
+
+#endif
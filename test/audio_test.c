@@ -0,0 +1,94 @@
+// host test for the audio analysis in ../audio.c, fed from a synthetic tone
+// in place of the ADC
+
+#include <stdlib.h>
+#include "audio.h"
+#include "audio_tone.h"
+#include "test.h"
+
+extern const int band_frequencies[AUDIO_BAND_COUNT];
+
+static audio_tone_t tone;
+
+static void run(int seconds) {
+	uint32_t end = tone.position + seconds * AUDIO_SAMPLE_RATE;
+	while (tone.position < end) audio_step();
+}
+
+// a steady tone on each band's centre lights that band and leaves the others
+// well down, after the auto gain has settled
+static void test_bands() {
+	for (int b = 0; b < AUDIO_BAND_COUNT; b++) {
+		audio_init(audio_tone_init(&tone, band_frequencies[b], 200));
+		audio_enable(true);
+		run(3);
+		const audio_levels_t *levels = audio_levels();
+		fprintf(stderr, "%3d Hz:", band_frequencies[b]);
+		for (int o = 0; o < AUDIO_BAND_COUNT; o++) fprintf(stderr, " %3d", levels->bands[o]);
+		fprintf(stderr, "\n");
+		CHECK(levels->bands[b] >= 192);
+		for (int o = 0; o < AUDIO_BAND_COUNT; o++) {
+			if (o != b) CHECK(levels->bands[o] < levels->bands[b] - 128);
+		}
+		audio_enable(false);
+	}
+}
+
+// no input, no steps: a stopped source is never read
+static void test_disabled() {
+	audio_init(audio_tone_init(&tone, 40, 200));
+	audio_step();
+	CHECK(tone.position == 0);
+	audio_enable(true);
+	audio_step();
+	CHECK(tone.position == AUDIO_MAX_SAMPLES_PER_STEP);
+	audio_enable(false);
+	CHECK(!tone.running);
+}
+
+static void test_beats() {
+	// a steady bass line is not a beat
+	audio_init(audio_tone_init(&tone, 45, 400));
+	audio_enable(true);
+	run(2);
+	uint32_t beats = audio_levels()->beats;
+	run(10);
+	CHECK(audio_levels()->beats == beats);
+	audio_enable(false);
+
+	// two 100ms kicks a second over a quiet bass line
+	audio_init(audio_tone_init(&tone, 45, 400));
+	tone.burst_rate = 2;
+	tone.burst_ms = 100;
+	tone.quiet = 10;
+	audio_enable(true);
+	run(2);
+	beats = audio_levels()->beats;
+	run(10);
+	fprintf(stderr, "beats in 10s at 2/s: %u\n", audio_levels()->beats - beats);
+	CHECK(audio_levels()->beats - beats == 20);
+	audio_enable(false);
+}
+
+// host cost of a full audio_step, for scale only: the lx106 has a single
+// cycle 32 bit multiply, so the ratio between steps carries over, not the time
+static void bench() {
+	audio_init(audio_tone_init(&tone, 70, 200));
+	audio_enable(true);
+	int steps = 200000;
+	uint64_t start = test_now_ns();
+	for (int i = 0; i < steps; i++) audio_step();
+	uint64_t elapsed = test_now_ns() - start;
+	fprintf(stderr, "audio_step: %.0f ns for %d samples (%.1f ns/sample, %d bands)\n",
+		(double) elapsed / steps, AUDIO_MAX_SAMPLES_PER_STEP,
+		(double) elapsed / steps / AUDIO_MAX_SAMPLES_PER_STEP, AUDIO_BAND_COUNT);
+	audio_enable(false);
+}
+
+int main(int argc, char **argv) {
+	test_disabled();
+	test_bands();
+	test_beats();
+	if (argc > 1) bench();
+	return TEST_RESULT("audio_test");
+}
@@ -0,0 +1,35 @@
+#include "audio_tone.h"
+
+#include <math.h>
+
+static void tone_start(audio_source_t *source) {
+	((audio_tone_t *) source)->running = true;
+}
+
+static void tone_stop(audio_source_t *source) {
+	((audio_tone_t *) source)->running = false;
+}
+
+// always has count samples pending, as if the ring were full
+static int tone_read(audio_source_t *source, int16_t *samples, int count) {
+	audio_tone_t *tone = (audio_tone_t *) source;
+	if (!tone->running) return 0;
+	for (int i = 0; i < count; i++, tone->position++) {
+		double t = (double) tone->position / AUDIO_SAMPLE_RATE;
+		int amplitude = tone->amplitude;
+		if (tone->burst_rate > 0 && fmod(t * tone->burst_rate, 1.0) * 1000 / tone->burst_rate >= tone->burst_ms) {
+			amplitude = tone->quiet;
+		}
+		samples[i] = 512 + lround(amplitude * sin(2 * M_PI * tone->frequency * t));
+	}
+	return count;
+}
+
+audio_source_t *audio_tone_init(audio_tone_t *tone, int frequency, int amplitude) {
+	*tone = (audio_tone_t) {
+		.source = { .start = tone_start, .stop = tone_stop, .read = tone_read },
+		.frequency = frequency,
+		.amplitude = amplitude,
+	};
+	return &tone->source;
+}
@@ -0,0 +1,21 @@
+#ifndef audio_tone_h
+#define audio_tone_h
+
+#include "audio.h"
+
+// synthetic audio_source_t: a sine on the 10 bit ADC scale, optionally gated
+// into bursts to make beats
+typedef struct {
+	audio_source_t source;
+	int frequency;     // Hz
+	int amplitude;     // 0 - 511
+	int burst_rate;    // bursts per second, 0 for a steady tone
+	int burst_ms;      // length of each burst
+	int quiet;         // amplitude between bursts
+	uint32_t position; // samples produced so far
+	bool running;
+} audio_tone_t;
+
+audio_source_t *audio_tone_init(audio_tone_t *tone, int frequency, int amplitude);
+
+#endif
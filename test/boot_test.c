@@ -0,0 +1,90 @@
+// host test for the boot path through ../ws2812.c: user_init stages the
+// restored scene and ws2812_init puts it on the strip before returning, at
+// once and without logging
+
+#include <unistd.h>
+#include "ws2812.h"
+#include "fake_output.h"
+#include "sim.h"
+#include "test.h"
+
+#define LED_COUNT 16
+
+static ws2812_pixel_t restored[2] = {
+	{{ .red = 200, .green = 100, .blue = 50 }},
+	{{ .red = 10, .green = 20, .blue = 30 }},
+};
+
+static fake_output_t *strip;
+
+// bytes written to stdout by fn, which is sent to a temporary file meanwhile
+static long logged(void (*fn)()) {
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	FILE *capture = tmpfile();
+	dup2(fileno(capture), STDOUT_FILENO);
+	fn();
+	fflush(stdout);
+	long size = lseek(STDOUT_FILENO, 0, SEEK_END);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	fclose(capture);
+	return size;
+}
+
+// what user_init does up to BOOT_FIRST_LIGHT: the restored scene goes
+// through applyHomeKit, then the power budget and the outputs
+static void boot() {
+	ws2812_beginBatch();
+	ws2812_setColors(2, restored);
+	ws2812_setBrightness(50);
+	ws2812_setMode(MD_SOLID);
+	ws2812_setSpeed(100);
+	ws2812_setReverseDirection(false);
+	ws2812_setDensity(25);
+	ws2812_setFade(50);
+	ws2812_setTransition(500);
+	ws2812_commitBatch();
+	ws2812_on(true);
+	ws2812_setPowerBudget(20, 0);
+
+	ws2812_output_t *outputs[] = { &strip->output };
+	ws2812_init(1, outputs);
+}
+
+static void setBrightness() {
+	ws2812_setBrightness(60);
+}
+
+// the first colour at half brightness
+static bool showsRestored() {
+	for (int i = 0; i < LED_COUNT; i++) {
+		int red, green, blue;
+		fake_output_rgb(strip, i, &red, &green, &blue);
+		if (red != 100 || green != 50 || blue != 25) return false;
+	}
+	return true;
+}
+
+int main() {
+	strip = fake_output(LED_COUNT, OT_GRB, true);
+
+	CHECK(logged(boot) == 0);
+	// first frame before ws2812_init returns, still on the first tick
+	CHECK(strip->frames == 1);
+	CHECK(strip->last_write == 0);
+	CHECK(showsRestored());
+
+	// no crossfade from black or brightness ramp after it
+	for (int i = 0; i < 60; i++) {
+		sim_run(10);
+		CHECK(showsRestored());
+	}
+	// the service loop's first pass is still on tick 0 and leaves the boot
+	// frame alone, then steps every tick
+	CHECK(strip->frames == 60);
+
+	// once the strip is lit setters log again
+	CHECK(logged(setBrightness) > 0);
+	return TEST_RESULT("boot_test");
+}
@@ -0,0 +1,121 @@
+// host test for the temporal dither in ../ws2812.c: every 8.8 channel value
+// has to average out to itself over the frames, and dim frames from the
+// service have to come out dithered
+
+#include <stdlib.h>
+#include "ws2812.h"
+#include "fake_output.h"
+#include "sim.h"
+#include "test.h"
+
+#define LED_COUNT 299
+#define FRAMES 256 // a whole cycle of the 8 bit error
+
+uint8_t dither(uint16_t value, uint8_t *error);
+void renderStep();
+
+static fake_output_t *strip;
+static ws2812_pixel_t white = {{ .red = 255, .green = 255, .blue = 255 }};
+
+// from any carried error, FRAMES frames of a value sum to the value itself,
+// each frame is one of the two nearest 8 bit steps and the running sum never
+// drifts a whole step from the target
+static bool averages(uint16_t value, uint8_t error) {
+	uint8_t low = value >> 8;
+	uint32_t sum = 0;
+	for (int frame = 1; frame <= FRAMES; frame++) {
+		uint8_t out = dither(value, &error);
+		if (out != low && out != low + 1) return false;
+		sum += out;
+		int32_t drift = (int32_t) (sum << 8) - (int32_t) (frame * value);
+		if (drift <= -256 || drift >= 256) return false;
+	}
+	return sum == value;
+}
+
+static void test_every_value() {
+	int failed = 0;
+	for (uint32_t value = 0; value <= 0xFF00; value++) {
+		if (!averages(value, 0) || !averages(value, value * 7) || !averages(value, 255)) failed++;
+	}
+	if (failed) fprintf(stderr, "%d of 65281 values off\n", failed);
+	CHECK(failed == 0);
+}
+
+// sum of pixel 0's red over FRAMES service frames, and whether it varied
+static uint32_t shownSum(bool *varied) {
+	uint32_t sum = 0;
+	int first = -1;
+	*varied = false;
+	for (int frame = 0; frame < FRAMES; frame++) {
+		sim_run(10);
+		int red, green, blue;
+		fake_output_rgb(strip, 0, &red, &green, &blue);
+		if (first < 0) first = red;
+		if (red != first) *varied = true;
+		sum += red;
+	}
+	return sum;
+}
+
+// white at 10% is 25.5 in 8.8 after the fixed point brightness steps, so
+// the strip alternates 25 and 26 and averages out within a few 1/256ths
+static void test_service() {
+	bool varied;
+	ws2812_setBrightness(10);
+	sim_run(100);
+	uint32_t sum = shownSum(&varied);
+	fprintf(stderr, "10%% white over %d frames: %u/256, target %d/256\n", FRAMES, sum, 255 * 256 / 10);
+	CHECK(varied);
+	CHECK(abs((int) sum - 255 * 256 / 10) <= 4);
+
+	// bright pixels are sent as they are
+	ws2812_setBrightness(100);
+	sim_run(100);
+	sum = shownSum(&varied);
+	CHECK(!varied);
+	CHECK(sum == 255 * FRAMES);
+}
+
+// host cost of the dither for every channel of a frame on its own, and of
+// a whole dim frame, dithered, against the same frame at full brightness,
+// not dithered
+static void bench() {
+	int rounds = 20000;
+	uint8_t *errors = calloc(LED_COUNT * 3, 1);
+	uint32_t sink = 0;
+	uint64_t start = test_now_ns();
+	for (int r = 0; r < rounds; r++) {
+		for (int c = 0; c < LED_COUNT * 3; c++) sink += dither(0x1980 + c, &errors[c]);
+	}
+	double dither_us = (test_now_ns() - start) / 1000.0 / rounds;
+	free(errors);
+	if (sink == 0) fprintf(stderr, "dither: nothing out\n");
+
+	double frame_us[2];
+	for (int dim = 0; dim < 2; dim++) {
+		ws2812_setBrightness(dim ? 10 : 100);
+		sim_run(100);
+		start = test_now_ns();
+		for (int r = 0; r < rounds; r++) renderStep();
+		frame_us[dim] = (test_now_ns() - start) / 1000.0 / rounds;
+	}
+	fprintf(stderr, "dither alone: %.2f us for %d channels, solid %d LEDs: %.2f us/frame at 100%%, %.2f us/frame at 10%% dithered\n",
+		dither_us, LED_COUNT * 3, LED_COUNT, frame_us[0], frame_us[1]);
+}
+
+int main(int argc, char **argv) {
+	test_every_value();
+
+	strip = fake_output(LED_COUNT, OT_GRB, false);
+	ws2812_output_t *outputs[] = { &strip->output };
+	ws2812_setColors(1, &white);
+	ws2812_setMode(MD_SOLID);
+	ws2812_setSpeed(100);
+	ws2812_setTransition(0);
+	ws2812_init(1, outputs);
+
+	test_service();
+	if (argc > 1) bench();
+	return TEST_RESULT("dither_test");
+}
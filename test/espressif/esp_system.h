@@ -0,0 +1,9 @@
+#ifndef esp_system_h
+#define esp_system_h
+
+#include <stdint.h>
+
+// us since boot, simulated by sim.c
+uint32_t sdk_system_get_time();
+
+#endif
@@ -0,0 +1,51 @@
+#include "fake_output.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "ws2812.h"
+#include "sim.h"
+
+fake_output_t *fake_output_log[FAKE_LOG_SIZE];
+int fake_output_log_count = 0;
+
+static void fake_init(ws2812_output_t *output) {
+	((fake_output_t *) output)->initialised = true;
+}
+
+static void fake_write(ws2812_output_t *output, ws2812_pixel_t *pixels) {
+	fake_output_t *fake = (fake_output_t *) output;
+	uint32_t wire = output->led_count * FAKE_WIRE_US_PER_PIXEL + FAKE_WIRE_RESET_US;
+	if ((int32_t) (fake->busy_until - sim_time) > 0) sim_busy(fake->busy_until - sim_time);
+	memcpy(fake->shown, pixels, output->led_count * sizeof(ws2812_pixel_t));
+	fake->last_write = sim_time;
+	fake->busy_until = sim_time + wire;
+	fake->frames++;
+	fake->wire_time += wire;
+	if (!output->async) sim_busy(wire);
+	if (fake_output_log_count < FAKE_LOG_SIZE) fake_output_log[fake_output_log_count++] = fake;
+}
+
+fake_output_t *fake_output(int led_count, int order_type, bool async) {
+	fake_output_t *fake = (fake_output_t *) calloc(1, sizeof(fake_output_t));
+	fake->output.led_count = led_count;
+	fake->output.order_type = order_type;
+	fake->output.async = async;
+	fake->output.pixel_buffer = (ws2812_pixel_t *) calloc(led_count, sizeof(ws2812_pixel_t));
+	fake->output.init = fake_init;
+	fake->output.write = fake_write;
+	fake->shown = (ws2812_pixel_t *) calloc(led_count, sizeof(ws2812_pixel_t));
+	return fake;
+}
+
+void fake_output_rgb(const fake_output_t *fake, int index, int *red, int *green, int *blue) {
+	const ws2812_pixel_t *p = &fake->shown[index];
+	*blue = p->blue;
+	if (fake->output.order_type == OT_RGB) {
+		*red = p->green;
+		*green = p->red;
+	}
+	else {
+		*red = p->red;
+		*green = p->green;
+	}
+}
@@ -0,0 +1,36 @@
+#ifndef fake_output_h
+#define fake_output_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ws2812_output.h"
+
+// Recording ws2812_output_t for the host tests. Each write is kept as the
+// strip would show it and takes the strip's wire time on the simulated
+// clock: a synchronous output blocks for the whole transfer like the
+// bit-banged one, an async one only waits for its previous transfer like I2S.
+
+#define FAKE_WIRE_US_PER_PIXEL 30 // 24 bits at 800kHz
+#define FAKE_WIRE_RESET_US     50 // latch time after each frame
+
+typedef struct {
+	ws2812_output_t output;
+	bool initialised;
+	uint32_t frames;       // writes seen
+	uint32_t wire_time;    // us the strip spent receiving, summed
+	uint32_t busy_until;   // simulated us the current transfer ends
+	uint32_t last_write;   // simulated us of the last write
+	ws2812_pixel_t *shown; // copy of the last frame written, in wire order
+} fake_output_t;
+
+fake_output_t *fake_output(int led_count, int order_type, bool async);
+
+// channel of a shown pixel in RGB terms, undoing the order_type swap
+void fake_output_rgb(const fake_output_t *fake, int index, int *red, int *green, int *blue);
+
+// every write in order across all fakes, until it fills up; tests reset the count
+#define FAKE_LOG_SIZE 16
+extern fake_output_t *fake_output_log[FAKE_LOG_SIZE];
+extern int fake_output_log_count;
+
+#endif
@@ -0,0 +1,253 @@
+// host comparison of a Scene write against the same change made one
+// characteristic at a time, through ../scene.c and ../ws2812.c on the
+// simulated tick. HomeKit's own cost per write (pairing crypto, JSON, the
+// network) is not modelled, only what the strip shows in between.
+
+#include <stdlib.h>
+#include <string.h>
+#include "converters.h"
+#include "scene.h"
+#include "ws2812.h"
+#include "fake_output.h"
+#include "sim.h"
+#include "test.h"
+
+#define LED_COUNT (2 * SCENE_COLOR_COUNT)
+#define SETTLE_TICKS 50
+
+static fake_output_t *strip;
+
+static const scene_t before = {
+	.on = 0x7F,
+	.hue = { 0, 50, 100, 150, 200, 250, 300 },
+	.saturation = { 100, 100, 100, 100, 100, 100, 100 },
+	.brightness = 100, .mode = MD_SEQUENCE, .speed = 100,
+	.reverse = 0, .density = 25, .fade = 50, .transition = 0,
+};
+
+static const scene_t after = {
+	.on = 0x7F,
+	.hue = { 20, 70, 120, 170, 220, 270, 320 },
+	.saturation = { 80, 80, 80, 80, 80, 80, 80 },
+	.brightness = 60, .mode = MD_SEQUENCE, .speed = 100,
+	.reverse = 1, .density = 40, .fade = 30, .transition = 0,
+};
+
+// what updateColors in homekit-ws2812.c passes on
+static void setColors(const scene_t *scene) {
+	ws2812_pixel_t colors[WS2812_MAX_COLORS];
+	int count = 0;
+	for (int i = 0; i < SCENE_COLOR_COUNT; i++) {
+		if (scene->on & (1 << i)) {
+			colors[count] = (ws2812_pixel_t) {{ 0, 0, 0, 0 }};
+			hs2rgb(scene->hue[i], scene->saturation[i] / 100.0f, &colors[count]);
+			count++;
+		}
+	}
+	ws2812_setColors(count, colors);
+}
+
+// applyHomeKit
+static void applyBatched(const scene_t *scene) {
+	ws2812_beginBatch();
+	setColors(scene);
+	ws2812_setBrightness(scene->brightness);
+	ws2812_setMode(scene->mode);
+	ws2812_setSpeed(scene->speed);
+	ws2812_setReverseDirection(scene->reverse);
+	ws2812_setDensity(scene->density);
+	ws2812_setFade(scene->fade);
+	ws2812_setTransition(scene->transition);
+	ws2812_commitBatch();
+}
+
+// the pixels shown, sorted so the effect's position doesn't matter
+typedef struct {
+	uint32_t pixels[LED_COUNT];
+} signature_t;
+
+static int compare(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+static signature_t shown() {
+	signature_t signature;
+	for (int i = 0; i < LED_COUNT; i++) {
+		int red, green, blue;
+		fake_output_rgb(strip, i, &red, &green, &blue);
+		signature.pixels[i] = (red << 16) | (green << 8) | blue;
+	}
+	qsort(signature.pixels, LED_COUNT, sizeof(uint32_t), compare);
+	return signature;
+}
+
+static bool same(const signature_t *a, const signature_t *b) {
+	return memcmp(a, b, sizeof(signature_t)) == 0;
+}
+
+typedef struct {
+	int intermediate; // frames showing neither the old nor the new scene
+	int settled;      // ticks from the first write to the new scene on the strip
+} latency_t;
+
+static signature_t old_frame;
+static signature_t new_frame;
+static latency_t latency;
+static int ticks;
+
+static void tick() {
+	sim_run(10);
+	ticks++;
+	signature_t frame = shown();
+	if (same(&frame, &new_frame)) {
+		if (latency.settled == 0) latency.settled = ticks;
+	}
+	else {
+		latency.settled = 0;
+		if (!same(&frame, &old_frame)) latency.intermediate++;
+	}
+}
+
+static void start() {
+	latency = (latency_t) { 0, 0 };
+	ticks = 0;
+}
+
+static void finish() {
+	for (int i = 0; i < SETTLE_TICKS; i++) tick();
+}
+
+static void sceneWrite(const scene_t *from, const scene_t *to) {
+	uint8_t blob[SCENE_BLOB_SIZE];
+	size_t size = scene_encode(to, blob, sizeof(blob));
+	start();
+	scene_t scene = *from;
+	CHECK(scene_decode(blob, size, &scene));
+	applyBatched(&scene);
+	finish();
+}
+
+// the same change as separate HomeKit writes: hue and saturation per
+// color and the six other characteristics, 20 in all, with tick() between
+// them when each arrives in its own request
+static int perCharacteristic(const scene_t *from, const scene_t *to, bool spaced) {
+	scene_t scene = *from;
+	int writes = 0;
+	start();
+	for (int i = 0; i < SCENE_COLOR_COUNT; i++) {
+		scene.hue[i] = to->hue[i];
+		setColors(&scene);
+		writes++;
+		if (spaced) tick();
+		scene.saturation[i] = to->saturation[i];
+		setColors(&scene);
+		writes++;
+		if (spaced) tick();
+	}
+	ws2812_setBrightness(to->brightness);
+	if (spaced) tick();
+	ws2812_setSpeed(to->speed);
+	if (spaced) tick();
+	ws2812_setReverseDirection(to->reverse);
+	if (spaced) tick();
+	ws2812_setDensity(to->density);
+	if (spaced) tick();
+	ws2812_setFade(to->fade);
+	if (spaced) tick();
+	ws2812_setTransition(to->transition);
+	writes += 6;
+	finish();
+	return writes;
+}
+
+// settles on each scene once to learn what it looks like
+static signature_t settle(const scene_t *scene) {
+	applyBatched(scene);
+	for (int i = 0; i < SETTLE_TICKS; i++) sim_run(10);
+	return shown();
+}
+
+static void report(const char *path) {
+	fprintf(stderr, "%-32s %2d intermediate frames, new scene after %3d ms\n",
+		path, latency.intermediate, latency.settled * 10);
+}
+
+static void expect(const signature_t *from, const signature_t *to) {
+	old_frame = *from;
+	new_frame = *to;
+}
+
+static void test_latency() {
+	signature_t frame_before = settle(&before);
+	signature_t frame_after = settle(&after);
+	CHECK(!same(&frame_before, &frame_after));
+	settle(&before);
+
+	expect(&frame_before, &frame_after);
+	sceneWrite(&before, &after);
+	report("scene write:");
+	CHECK(latency.intermediate == 0);
+	CHECK(latency.settled == 1);
+
+	expect(&frame_after, &frame_before);
+	CHECK(perCharacteristic(&after, &before, true) == 20);
+	report("20 writes, one per tick:");
+	// the sorted frame can't see reverse, density, fade or transition, so
+	// it settles with brightness, the 15th write
+	CHECK(latency.intermediate == 14);
+	CHECK(latency.settled == 15);
+
+	// if they all land between two frames nothing shows, but that is up to
+	// the controller and the network
+	expect(&frame_before, &frame_after);
+	perCharacteristic(&before, &after, false);
+	report("20 writes within one tick:");
+	CHECK(latency.intermediate == 0);
+	CHECK(latency.settled == 1);
+}
+
+// host CPU time of each path's calls, logging included since the setters
+// print on the device too
+static void bench() {
+	uint8_t blob[SCENE_BLOB_SIZE];
+	size_t size = scene_encode(&after, blob, sizeof(blob));
+	int rounds = 20000;
+	uint64_t start = test_now_ns();
+	for (int i = 0; i < rounds; i++) {
+		scene_t scene = before;
+		scene_decode(blob, size, &scene);
+		applyBatched(&scene);
+	}
+	uint64_t batched = test_now_ns() - start;
+	start = test_now_ns();
+	for (int i = 0; i < rounds; i++) {
+		scene_t scene = before;
+		for (int c = 0; c < SCENE_COLOR_COUNT; c++) {
+			scene.hue[c] = after.hue[c];
+			setColors(&scene);
+			scene.saturation[c] = after.saturation[c];
+			setColors(&scene);
+		}
+		ws2812_setBrightness(after.brightness);
+		ws2812_setSpeed(after.speed);
+		ws2812_setReverseDirection(after.reverse);
+		ws2812_setDensity(after.density);
+		ws2812_setFade(after.fade);
+		ws2812_setTransition(after.transition);
+	}
+	uint64_t separate = test_now_ns() - start;
+	fprintf(stderr, "scene_decode + batched apply: %.2f us, 20 setter calls: %.2f us\n",
+		batched / 1000.0 / rounds, separate / 1000.0 / rounds);
+}
+
+int main(int argc, char **argv) {
+	strip = fake_output(LED_COUNT, OT_GRB, true);
+	ws2812_output_t *outputs[] = { &strip->output };
+	applyBatched(&before);
+	ws2812_init(1, outputs);
+
+	test_latency();
+	if (argc > 1) bench();
+	return TEST_RESULT("latency_test");
+}
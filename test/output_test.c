@@ -0,0 +1,114 @@
+// host test for how ../ws2812.c drives its outputs: one logical strip
+// across outputs in declaration order, async outputs written first, byte
+// order and reversal, on the simulated clock from sim.c
+
+#include <stdlib.h>
+#include "ws2812.h"
+#include "fake_output.h"
+#include "sim.h"
+#include "test.h"
+
+// sync first in declaration order, so the async one has to be moved ahead
+#define SYNC_COUNT 10
+#define ASYNC_COUNT 6
+
+static fake_output_t *sync_output;
+static fake_output_t *async_output;
+
+static ws2812_pixel_t colors[3] = {
+	{{ .red = 255 }},
+	{{ .green = 255 }},
+	{{ .blue = 255 }},
+};
+
+// which of the colors logical pixel i shows, -1 for anything else
+static int shownColor(int i) {
+	int red, green, blue;
+	if (i < SYNC_COUNT) fake_output_rgb(sync_output, i, &red, &green, &blue);
+	else fake_output_rgb(async_output, i - SYNC_COUNT, &red, &green, &blue);
+	for (int c = 0; c < 3; c++) {
+		if (red == colors[c].red && green == colors[c].green && blue == colors[c].blue) return c;
+	}
+	return -1;
+}
+
+// the sequence effect steps through the colors one pixel at a time, so any
+// gap, swap or misplaced output breaks the run
+static bool isSequence(int direction) {
+	for (int i = 0; i + 1 < SYNC_COUNT + ASYNC_COUNT; i++) {
+		int c = shownColor(i);
+		if (c < 0 || shownColor(i + 1) != (c + direction + 3) % 3) return false;
+	}
+	return true;
+}
+
+static void test_boot_frame() {
+	CHECK(sync_output->output.offset == 0);
+	CHECK(async_output->output.offset == SYNC_COUNT);
+	CHECK(sync_output->initialised && async_output->initialised);
+	CHECK(sync_output->frames == 1 && async_output->frames == 1);
+	CHECK(fake_output_log_count == 2);
+	CHECK(fake_output_log[0] == async_output);
+	CHECK(fake_output_log[1] == sync_output);
+	CHECK(isSequence(1));
+}
+
+static void test_running() {
+	int first = shownColor(0);
+	ws2812_stats_t stats;
+	ws2812_getStats(&stats);
+	fake_output_log_count = 0;
+	sim_run(100);
+	ws2812_getStats(&stats);
+	// a step on every 10ms tick
+	CHECK(stats.frames == 10);
+	CHECK(sync_output->frames == 11 && async_output->frames == 11);
+	CHECK(isSequence(1));
+	CHECK(shownColor(0) == (first + 10) % 3);
+	for (int i = 0; i + 1 < fake_output_log_count; i += 2) {
+		CHECK(fake_output_log[i] == async_output && fake_output_log[i + 1] == sync_output);
+	}
+	// only the bit-banged strip holds up the frame, I2S sends in the background
+	CHECK(stats.write_time_avg == SYNC_COUNT * FAKE_WIRE_US_PER_PIXEL + FAKE_WIRE_RESET_US);
+	CHECK(async_output->wire_time == async_output->frames * (ASYNC_COUNT * FAKE_WIRE_US_PER_PIXEL + FAKE_WIRE_RESET_US));
+	CHECK(async_output->last_write <= sync_output->last_write);
+}
+
+static void test_reversed() {
+	ws2812_setReverseDirection(true);
+	sim_run(20);
+	CHECK(isSequence(-1));
+	ws2812_setReverseDirection(false);
+	sim_run(20);
+	CHECK(isSequence(1));
+}
+
+static void test_off() {
+	ws2812_on(false);
+	uint32_t frames = sync_output->frames;
+	for (int i = 0; i < SYNC_COUNT + ASYNC_COUNT; i++) CHECK(shownColor(i) == -1);
+	sim_run(100);
+	CHECK(sync_output->frames == frames);
+	ws2812_on(true);
+	sim_run(10);
+	CHECK(isSequence(1));
+}
+
+int main() {
+	sync_output = fake_output(SYNC_COUNT, OT_GRB, false);
+	async_output = fake_output(ASYNC_COUNT, OT_RGB, true);
+	ws2812_output_t *outputs[] = { &sync_output->output, &async_output->output };
+
+	ws2812_setColors(3, colors);
+	ws2812_setBrightness(100);
+	ws2812_setSpeed(100);
+	ws2812_setMode(MD_SEQUENCE);
+	ws2812_setTransition(0);
+	ws2812_init(2, outputs);
+
+	test_boot_frame();
+	test_running();
+	test_reversed();
+	test_off();
+	return TEST_RESULT("output_test");
+}
@@ -0,0 +1,111 @@
+// host test and benchmark for the organic effects in ../ws2812.c on a 299
+// LED strip, the longest the bundled configurations drive, which has to
+// hold 50 frames per second
+
+#include <math.h>
+#include "ws2812.h"
+#include "fake_output.h"
+#include "sim.h"
+#include "test.h"
+
+#define LED_COUNT 299
+#define FRAME_BUDGET_US 20000 // 50fps
+
+uint8_t sin8(uint8_t theta);
+void renderStep();
+
+static ws2812_pixel_t colors[3] = {
+	{{ .red = 255 }},
+	{{ .green = 255 }},
+	{{ .blue = 255 }},
+};
+
+static const int modes[] = { MD_PLASMA, MD_NOISE, MD_GRADIENT };
+static const char *mode_names[] = { "plasma", "noise", "gradient" };
+
+// the table is what the boot time loop used to compute
+static void test_sin8() {
+	for (int i = 0; i < 256; i++) {
+		uint8_t expected = 128 + 127 * sin(i * 2 * M_PI / 256);
+		CHECK(sin8(i) == expected);
+	}
+}
+
+// at full speed every service tick is a frame, with the wire time of the
+// whole strip inside the tick
+static void test_frame_rate(int mode) {
+	ws2812_setMode(mode);
+	sim_run(100);
+	ws2812_stats_t stats;
+	ws2812_getStats(&stats);
+	sim_run(1000);
+	ws2812_getStats(&stats);
+	CHECK(stats.frames == 100);
+	CHECK(stats.skipped_frames == 0);
+}
+
+// us per renderStep, the best of a few runs since the host is noisy
+static double timeFrames(int frames) {
+	double best = 0;
+	for (int run = 0; run < 5; run++) {
+		uint64_t start = test_now_ns();
+		for (int i = 0; i < frames; i++) renderStep();
+		double frame_us = (test_now_ns() - start) / 1000.0 / frames;
+		if (run == 0 || frame_us < best) best = frame_us;
+	}
+	return best;
+}
+
+// host CPU time of one renderStep, the output copy included, against the
+// 50fps budget less the wire time. The lx106 runs at 80 or 160MHz with
+// float in software, so only the margin and the ratio between modes mean
+// anything here, not the time itself
+static void bench() {
+	int wire_us = LED_COUNT * FAKE_WIRE_US_PER_PIXEL + FAKE_WIRE_RESET_US;
+	int frames = 20000;
+	for (int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		ws2812_setMode(modes[m]);
+		sim_run(20);
+		double frame_us = timeFrames(frames);
+		int left_us = FRAME_BUDGET_US - wire_us;
+		fprintf(stderr, "%-8s %d LEDs: %6.2f us/frame, %d us left of a 50fps frame after the wire (%.0fx)\n",
+			mode_names[m], LED_COUNT, frame_us, left_us, left_us / frame_us);
+	}
+}
+
+// the same with the current limit off, as without PSU_LIMIT_MA, and on at
+// a limit every frame goes over, so each one is scaled as it is encoded
+static void benchLimit() {
+	static const int limit_modes[] = { MD_SOLID, MD_TWINKLE, MD_PLASMA };
+	static const char *limit_names[] = { "solid", "twinkle", "plasma" };
+	int frames = 20000;
+	for (int m = 0; m < sizeof(limit_modes) / sizeof(limit_modes[0]); m++) {
+		double frame_us[2];
+		for (int limited = 0; limited < 2; limited++) {
+			ws2812_setPowerBudget(20, limited ? 1000 : 0);
+			ws2812_setMode(limit_modes[m]);
+			sim_run(20);
+			frame_us[limited] = timeFrames(frames);
+		}
+		fprintf(stderr, "%-8s %d LEDs: %6.2f us/frame without a limit, %6.2f us/frame limited to 1000mA (%+.1f%%)\n",
+			limit_names[m], LED_COUNT, frame_us[0], frame_us[1], (frame_us[1] / frame_us[0] - 1) * 100);
+	}
+	ws2812_setPowerBudget(20, 0);
+}
+
+int main(int argc, char **argv) {
+	fake_output_t *strip = fake_output(LED_COUNT, OT_GRB, false);
+	ws2812_output_t *outputs[] = { &strip->output };
+	ws2812_setColors(3, colors);
+	ws2812_setSpeed(100);
+	ws2812_setTransition(0);
+	ws2812_init(1, outputs);
+
+	test_sin8();
+	for (int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) test_frame_rate(modes[m]);
+	if (argc > 1) {
+		bench();
+		benchLimit();
+	}
+	return TEST_RESULT("render_test");
+}
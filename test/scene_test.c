@@ -0,0 +1,215 @@
+#include "scene.h"
+#include "ws2812.h"
+#include "test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define FUZZ_ROUNDS 200000
+
+static uint32_t rng = 2463534242u;
+
+static uint32_t next() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static int between(int min, int max) {
+	return min + next() % (max - min + 1);
+}
+
+static void random_scene(scene_t *scene) {
+	memset(scene, 0, sizeof(scene_t));
+	scene->on = between(0, 127);
+	for (int i = 0; i < SCENE_COLOR_COUNT; i++) {
+		scene->hue[i] = between(0, 360);
+		scene->saturation[i] = between(0, 100);
+	}
+	scene->brightness = between(0, 100);
+	scene->mode = between(MD_SOLID, MD_LAST);
+	scene->speed = between(0, 100);
+	scene->reverse = between(0, 1);
+	scene->density = between(1, 100);
+	scene->fade = between(1, 100);
+	scene->transition = between(0, 5000);
+}
+
+static bool valid(const scene_t *scene) {
+	for (int i = 0; i < SCENE_COLOR_COUNT; i++) {
+		if (scene->hue[i] > 360 || scene->saturation[i] > 100) return false;
+	}
+	return scene->on < 128 && scene->brightness <= 100
+		&& scene->mode >= MD_SOLID && scene->mode <= MD_LAST
+		&& scene->speed <= 100 && scene->reverse <= 1
+		&& scene->density >= 1 && scene->density <= 100
+		&& scene->fade >= 1 && scene->fade <= 100
+		&& scene->transition <= 5000;
+}
+
+static void test_round_trip() {
+	uint8_t blob[SCENE_BLOB_SIZE];
+	for (int n = 0; n < 1000; n++) {
+		scene_t scene, decoded;
+		random_scene(&scene);
+		random_scene(&decoded);
+		CHECK(scene_encode(&scene, blob, sizeof(blob)) == SCENE_BLOB_SIZE);
+		CHECK(scene_decode(blob, SCENE_BLOB_SIZE, &decoded));
+		CHECK(memcmp(&scene, &decoded, sizeof(scene_t)) == 0);
+	}
+	scene_t scene;
+	random_scene(&scene);
+	CHECK(scene_encode(&scene, blob, SCENE_BLOB_SIZE - 1) == 0);
+}
+
+// a blob cut anywhere inside an entry is rejected and changes nothing
+static void test_truncated() {
+	uint8_t blob[SCENE_BLOB_SIZE];
+	scene_t scene, target, decoded;
+	random_scene(&scene);
+	random_scene(&target);
+	scene_encode(&scene, blob, sizeof(blob));
+
+	// an empty blob has no version entry
+	size_t boundary = 0;
+	for (size_t size = 0; size < SCENE_BLOB_SIZE; size++) {
+		decoded = target;
+		bool ok = scene_decode(blob, size, &decoded);
+		if (size == boundary) {
+			CHECK(ok == (size > 0));
+			boundary += 2 + blob[boundary + 1];
+		}
+		else {
+			CHECK(!ok);
+			CHECK(memcmp(&decoded, &target, sizeof(scene_t)) == 0);
+		}
+	}
+}
+
+// unknown entries past the known ones are skipped, a length running past
+// the end is not
+static void test_oversized() {
+	uint8_t blob[SCENE_BLOB_SIZE + 260];
+	scene_t scene, decoded;
+	random_scene(&scene);
+	size_t size = scene_encode(&scene, blob, sizeof(blob));
+	blob[size] = 200;
+	blob[size + 1] = 255;
+	memset(&blob[size + 2], 0xAB, 255);
+
+	random_scene(&decoded);
+	CHECK(scene_decode(blob, size + 257, &decoded));
+	CHECK(memcmp(&scene, &decoded, sizeof(scene_t)) == 0);
+
+	random_scene(&decoded);
+	scene_t before = decoded;
+	CHECK(!scene_decode(blob, size + 256, &decoded));
+	CHECK(memcmp(&before, &decoded, sizeof(scene_t)) == 0);
+
+	// known type with the wrong length
+	uint8_t brightness[] = { SCENE_TLV_VERSION, 1, SCENE_VERSION, SCENE_TLV_BRIGHTNESS, 2, 50, 0 };
+	CHECK(!scene_decode(brightness, sizeof(brightness), &decoded));
+}
+
+static bool accepts(uint8_t type, const uint8_t *value, uint8_t length) {
+	uint8_t blob[5 + SCENE_COLOR_COUNT * SCENE_COLOR_SIZE] = { SCENE_TLV_VERSION, 1, SCENE_VERSION, type, length };
+	memcpy(&blob[5], value, length);
+	scene_t scene, before;
+	random_scene(&scene);
+	before = scene;
+	bool ok = scene_decode(blob, 5 + length, &scene);
+	if (!ok) CHECK(memcmp(&before, &scene, sizeof(scene_t)) == 0);
+	return ok;
+}
+
+static bool accepts_byte(uint8_t type, uint8_t value) {
+	return accepts(type, &value, 1);
+}
+
+static void test_out_of_range() {
+	CHECK(accepts(SCENE_TLV_COLOR, (uint8_t[]) { 6, 0x68, 0x01, 100 }, 4));
+	CHECK(!accepts(SCENE_TLV_COLOR, (uint8_t[]) { 7, 0, 0, 0 }, 4));
+	CHECK(!accepts(SCENE_TLV_COLOR, (uint8_t[]) { 0, 0x69, 0x01, 0 }, 4));
+	CHECK(!accepts(SCENE_TLV_COLOR, (uint8_t[]) { 0, 0, 0, 101 }, 4));
+	// any number of colors in one entry, all or nothing
+	CHECK(accepts(SCENE_TLV_COLOR, (uint8_t[]) { 0, 10, 0, 50, 3, 20, 0, 60 }, 8));
+	CHECK(!accepts(SCENE_TLV_COLOR, (uint8_t[]) { 0, 10, 0, 50, 3, 20, 0, 101 }, 8));
+	CHECK(!accepts(SCENE_TLV_COLOR, (uint8_t[]) { 0, 10, 0, 50, 3 }, 5));
+	CHECK(!accepts(SCENE_TLV_COLOR, (uint8_t[]) { 0 }, 0));
+	CHECK(accepts_byte(SCENE_TLV_ON, 0x7F));
+	CHECK(!accepts_byte(SCENE_TLV_ON, 0x80));
+	CHECK(accepts_byte(SCENE_TLV_BRIGHTNESS, 100));
+	CHECK(!accepts_byte(SCENE_TLV_BRIGHTNESS, 101));
+	CHECK(accepts_byte(SCENE_TLV_MODE, MD_LAST));
+	CHECK(!accepts_byte(SCENE_TLV_MODE, MD_SOLID - 1));
+	CHECK(!accepts_byte(SCENE_TLV_MODE, MD_LAST + 1));
+	CHECK(!accepts_byte(SCENE_TLV_SPEED, 101));
+	CHECK(!accepts_byte(SCENE_TLV_REVERSE, 2));
+	CHECK(!accepts_byte(SCENE_TLV_DENSITY, 0));
+	CHECK(!accepts_byte(SCENE_TLV_DENSITY, 101));
+	CHECK(!accepts_byte(SCENE_TLV_FADE, 0));
+	CHECK(!accepts_byte(SCENE_TLV_FADE, 101));
+	CHECK(accepts(SCENE_TLV_TRANSITION, (uint8_t[]) { 0x88, 0x13 }, 2));
+	CHECK(!accepts(SCENE_TLV_TRANSITION, (uint8_t[]) { 0x89, 0x13 }, 2));
+
+	scene_t scene;
+	random_scene(&scene);
+	uint8_t version[] = { SCENE_TLV_VERSION, 1, SCENE_VERSION + 1 };
+	CHECK(!scene_decode(version, sizeof(version), &scene));
+	CHECK(!scene_decode(version, 0, &scene));
+	uint8_t unversioned[] = { SCENE_TLV_BRIGHTNESS, 1, 50 };
+	CHECK(!scene_decode(unversioned, sizeof(unversioned), &scene));
+}
+
+// a TLV8 writer may put the version anywhere and leave a long value split
+// into consecutive entries of the same type
+static void test_order() {
+	scene_t scene;
+	random_scene(&scene);
+	uint8_t blob[] = {
+		SCENE_TLV_BRIGHTNESS, 1, 42,
+		SCENE_TLV_COLOR, 4, 1, 0x2C, 0x01, 70,
+		SCENE_TLV_COLOR, 4, 5, 0x0A, 0x00, 20,
+		SCENE_TLV_VERSION, 1, SCENE_VERSION,
+	};
+	CHECK(scene_decode(blob, sizeof(blob), &scene));
+	CHECK(scene.brightness == 42);
+	CHECK(scene.hue[1] == 300 && scene.saturation[1] == 70);
+	CHECK(scene.hue[5] == 10 && scene.saturation[5] == 20);
+}
+
+// random blobs, mostly made of real entry types after a version entry
+static void test_fuzz() {
+	uint8_t blob[96];
+	for (int n = 0; n < FUZZ_ROUNDS; n++) {
+		size_t size = between(0, sizeof(blob));
+		for (size_t i = 0; i < size; i++) blob[i] = next();
+		if (size >= 3) memcpy(blob, (uint8_t[]) { SCENE_TLV_VERSION, 1, SCENE_VERSION }, 3);
+		for (size_t pos = 3; pos + 1 < size && next() % 4; pos += 2 + blob[pos + 1]) {
+			blob[pos] = between(SCENE_TLV_VERSION, SCENE_TLV_TRANSITION + 1);
+			blob[pos + 1] = blob[pos] == SCENE_TLV_COLOR ? 4 * between(0, 2)
+				: blob[pos] == SCENE_TLV_TRANSITION ? 2 : between(0, 2);
+		}
+
+		scene_t scene, before;
+		random_scene(&scene);
+		before = scene;
+		if (scene_decode(blob, size, &scene)) {
+			CHECK(valid(&scene));
+		}
+		else {
+			CHECK(memcmp(&before, &scene, sizeof(scene_t)) == 0);
+		}
+	}
+}
+
+int main() {
+	test_round_trip();
+	test_truncated();
+	test_oversized();
+	test_out_of_range();
+	test_order();
+	test_fuzz();
+	return TEST_RESULT("scene_test");
+}
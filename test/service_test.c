@@ -0,0 +1,128 @@
+// host test for the ws2812Service loop in ../ws2812.c on the simulated tick
+
+#include "ws2812.h"
+#include "fake_output.h"
+#include "sim.h"
+#include "test.h"
+
+#include <string.h>
+
+#define LED_COUNT 8
+
+static fake_output_t *strip;
+static ws2812_pixel_t white = {{ .red = 255, .green = 255, .blue = 255 }};
+static ws2812_pixel_t red = {{ .red = 255 }};
+static ws2812_pixel_t green = {{ .green = 255 }};
+static ws2812_pixel_t blue = {{ .blue = 255 }};
+
+static uint32_t skipped(uint32_t ms, uint32_t stall) {
+	ws2812_stats_t stats;
+	ws2812_getStats(&stats);
+	sim_run(ms / 2);
+	if (stall > 0) sim_stall(stall);
+	sim_run(ms - ms / 2);
+	ws2812_getStats(&stats);
+	return stats.skipped_frames;
+}
+
+// speed maps to a delay of (100 - speed) * 2.5ms, solid runs at that delay
+static void test_skipped(int speed, uint32_t stall, uint32_t expected) {
+	ws2812_setSpeed(speed);
+	sim_run(100);
+	uint32_t count = skipped(3000, stall);
+	if (count != expected) fprintf(stderr, "speed %d, %ums stall: %u skipped\n", speed, stall, count);
+	CHECK(count == expected);
+}
+
+static void test_frame_rate() {
+	ws2812_setSpeed(100);
+	sim_run(100);
+	ws2812_stats_t stats;
+	ws2812_getStats(&stats);
+	sim_run(1000);
+	ws2812_getStats(&stats);
+	CHECK(stats.frames == 100);
+	CHECK(stats.window == 1000);
+}
+
+static bool shows(const ws2812_pixel_t *color) {
+	for (int i = 0; i < LED_COUNT; i++) {
+		int r, g, b;
+		fake_output_rgb(strip, i, &r, &g, &b);
+		if (r != color->red || g != color->green || b != color->blue) return false;
+	}
+	return true;
+}
+
+static void buildSolid(ws2812_params_t *params, ws2812_pixel_t *color) {
+	ws2812_initParams(params, 1, color, 100, MD_SOLID, 100, false, 25, 50);
+}
+
+// a preset stored while the service shows it, or is about to, only takes
+// effect at the next recall
+static void test_store() {
+	ws2812_params_t preset, built;
+	ws2812_setTransition(0);
+	buildSolid(&preset, &red);
+	ws2812_recallParams(&preset);
+	sim_run(20);
+	CHECK(shows(&red));
+
+	buildSolid(&built, &blue);
+	ws2812_storeParams(&preset, &built);
+	memset(&built, 0, sizeof(built));
+	CHECK(preset.colors[0].blue == 255);
+	sim_run(20);
+	CHECK(shows(&red));
+	ws2812_recallParams(&preset);
+	sim_run(20);
+	CHECK(shows(&blue));
+
+	buildSolid(&built, &red);
+	ws2812_storeParams(&preset, &built);
+	ws2812_recallParams(&preset);
+	buildSolid(&built, &green);
+	ws2812_storeParams(&preset, &built);
+	sim_run(20);
+	CHECK(shows(&red));
+	ws2812_recallParams(&preset);
+	sim_run(20);
+	CHECK(shows(&green));
+
+	// the service is done with the slot once a setter moves it on
+	ws2812_setColors(1, &white);
+	sim_run(20);
+	CHECK(shows(&white));
+	buildSolid(&built, &blue);
+	ws2812_storeParams(&preset, &built);
+	sim_run(20);
+	CHECK(shows(&white));
+}
+
+int main() {
+	strip = fake_output(LED_COUNT, OT_GRB, true);
+	ws2812_output_t *outputs[] = { &strip->output };
+	ws2812_setColors(1, &white);
+	ws2812_setMode(MD_SOLID);
+	ws2812_init(1, outputs);
+
+	test_frame_rate();
+
+	// below a tick, every tick is a step: none missed on time, one per late tick
+	test_skipped(99, 0, 0);
+	test_skipped(99, 10, 1);
+	test_skipped(99, 30, 3);
+	test_skipped(100, 10, 1);
+	// 25ms runs every third tick; a stall only pushes the next step back by
+	// however much of it is left after the step was due, so whatever the
+	// phase 20ms costs nothing and 60ms costs one step
+	test_skipped(90, 0, 0);
+	test_skipped(90, 20, 0);
+	test_skipped(90, 60, 1);
+	// 250ms runs every 26th tick
+	test_skipped(0, 0, 0);
+	test_skipped(0, 520, 1);
+
+	test_store();
+	return TEST_RESULT("service_test");
+}
@@ -0,0 +1,92 @@
+#include "sim.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include <espressif/esp_system.h>
+
+#define TICK_US (portTICK_PERIOD_MS * 1000)
+
+uint32_t sim_time = 0;
+
+static TaskFunction_t task_code;
+static void *task_parameters;
+// the task gets its own thread, but only one side runs at a time
+static pthread_t task_thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t handover = PTHREAD_COND_INITIALIZER;
+static bool task_turn = false;
+static bool task_started = false;
+static uint32_t run_end;
+static uint32_t stall = 0;
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint16_t stack_depth,
+		void *parameters, UBaseType_t priority, TaskHandle_t *handle) {
+	if (task_code != NULL) {
+		fprintf(stderr, "sim: only one task, %s\n", name);
+		abort();
+	}
+	task_code = code;
+	task_parameters = parameters;
+	if (handle != NULL) *handle = (TaskHandle_t) code;
+	return pdPASS;
+}
+
+// hands the CPU to the other side and waits for it back
+static void yield(bool to_task) {
+	pthread_mutex_lock(&lock);
+	task_turn = to_task;
+	pthread_cond_broadcast(&handover);
+	while (task_turn == to_task) pthread_cond_wait(&handover, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+static void *task_entry(void *arg) {
+	pthread_mutex_lock(&lock);
+	while (!task_turn) pthread_cond_wait(&handover, &lock);
+	pthread_mutex_unlock(&lock);
+	task_code(task_parameters);
+	fprintf(stderr, "sim: task returned\n");
+	abort();
+}
+
+void vTaskDelay(TickType_t ticks) {
+	// wakes on a tick boundary, the delay counts from the current tick
+	sim_time = (sim_time / TICK_US + ticks) * TICK_US + stall * 1000;
+	stall = 0;
+	if ((int32_t) (sim_time - run_end) >= 0) yield(false);
+}
+
+TickType_t xTaskGetTickCount() {
+	return sim_time / TICK_US;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+	return 0;
+}
+
+uint32_t sdk_system_get_time() {
+	return sim_time;
+}
+
+void sim_run(uint32_t ms) {
+	if (task_code == NULL) return;
+	run_end = sim_time + ms * 1000;
+	if (!task_started) {
+		pthread_create(&task_thread, NULL, task_entry, NULL);
+		pthread_detach(task_thread);
+		task_started = true;
+	}
+	yield(true);
+}
+
+void sim_stall(uint32_t ms) {
+	stall += ms;
+}
+
+void sim_busy(uint32_t us) {
+	sim_time += us;
+}
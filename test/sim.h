@@ -0,0 +1,22 @@
+#ifndef sim_h
+#define sim_h
+
+#include <stdint.h>
+
+// Simulated clock and scheduler for running the firmware's tasks on the
+// host. Time only moves when a task delays or an output is busy on the wire,
+// so a test sees exactly the ticks it asks for.
+
+extern uint32_t sim_time; // us, what sdk_system_get_time returns
+
+// runs the task created by xTaskCreate until the clock has moved on by ms,
+// it picks up where it stopped on the next call
+void sim_run(uint32_t ms);
+
+// the task's next delay overruns by ms, as if something else held the CPU
+void sim_stall(uint32_t ms);
+
+// the running code takes us, e.g. a blocking write
+void sim_busy(uint32_t us);
+
+#endif
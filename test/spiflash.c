@@ -0,0 +1,38 @@
+#include "spiflash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// NOR semantics: a write can only clear bits, an erase sets a sector to 0xFF
+static FILE *flash;
+int spiflash_write_budget = -1;
+int spiflash_erase_count = 0;
+
+void spiflash_open(uint32_t size) {
+	if (flash) fclose(flash);
+	flash = tmpfile();
+	for (uint32_t i = 0; i < size; i++) fputc(0xFF, flash);
+	spiflash_write_budget = -1;
+	spiflash_erase_count = 0;
+}
+
+bool spiflash_read(uint32_t addr, uint8_t *buf, uint32_t size) {
+	return fseek(flash, addr, SEEK_SET) == 0 && fread(buf, 1, size, flash) == size;
+}
+
+bool spiflash_write(uint32_t addr, uint8_t *buf, uint32_t size) {
+	uint8_t cells[size];
+	if (!spiflash_read(addr, cells, size)) return false;
+	uint32_t count = spiflash_write_budget >= 0 && (uint32_t) spiflash_write_budget < size ? spiflash_write_budget : size;
+	for (uint32_t i = 0; i < count; i++) cells[i] &= buf[i];
+	if (spiflash_write_budget >= 0) spiflash_write_budget -= count;
+	return fseek(flash, addr, SEEK_SET) == 0 && fwrite(cells, 1, count, flash) == count && count == size;
+}
+
+bool spiflash_erase_sector(uint32_t addr) {
+	uint8_t ones[SPI_FLASH_SECTOR_SIZE];
+	memset(ones, 0xFF, sizeof(ones));
+	spiflash_erase_count++;
+	addr -= addr % SPI_FLASH_SECTOR_SIZE;
+	return fseek(flash, addr, SEEK_SET) == 0 && fwrite(ones, 1, sizeof(ones), flash) == sizeof(ones);
+}
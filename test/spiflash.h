@@ -0,0 +1,20 @@
+#ifndef spiflash_h
+#define spiflash_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SPI_FLASH_SECTOR_SIZE 4096
+
+// same calls as esp-open-rtos' spiflash.h, backed by a temporary file
+bool spiflash_read(uint32_t addr, uint8_t *buf, uint32_t size);
+bool spiflash_write(uint32_t addr, uint8_t *buf, uint32_t size);
+bool spiflash_erase_sector(uint32_t addr);
+
+// fresh flash of the given size, all 0xFF
+void spiflash_open(uint32_t size);
+
+extern int spiflash_write_budget; // bytes written before the power cut, -1 for no cut
+extern int spiflash_erase_count;
+
+#endif
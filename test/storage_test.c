@@ -0,0 +1,130 @@
+#include "storage.h"
+#include "spiflash.h"
+#include "test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define BASE_ADDR 0x1000
+#define FLASH_SIZE (BASE_ADDR + 2 * STORAGE_SECTOR_SIZE)
+#define RECORD_SIZE 64
+#define DATA_SIZE 30 // a scene_t, as homekit-ws2812.c stores it
+#define SLOTS (2 * STORAGE_SECTOR_SIZE / RECORD_SIZE)
+#define HEADER_SIZE 12 // record_header_t
+
+static void fill(uint8_t *data, int n) {
+	for (int i = 0; i < DATA_SIZE; i++) data[i] = n + i;
+}
+
+static bool save(storage_log_t *log, int n) {
+	uint8_t data[DATA_SIZE];
+	fill(data, n);
+	return storage_save(log, data, DATA_SIZE);
+}
+
+static bool loads(storage_log_t *log, int n) {
+	uint8_t expected[DATA_SIZE], data[DATA_SIZE];
+	fill(expected, n);
+	return storage_load(log, data, DATA_SIZE) && memcmp(data, expected, DATA_SIZE) == 0;
+}
+
+// what the firmware does after a reset
+static void reboot(storage_log_t *log) {
+	storage_init(log, BASE_ADDR, RECORD_SIZE);
+}
+
+static void test_empty() {
+	storage_log_t log;
+	spiflash_open(FLASH_SIZE);
+	reboot(&log);
+	uint8_t data[DATA_SIZE];
+	CHECK(!storage_load(&log, data, DATA_SIZE));
+	CHECK(save(&log, 1));
+	reboot(&log);
+	CHECK(loads(&log, 1));
+}
+
+// power cut part way through every byte of a record that isn't complete yet
+static void test_torn_record() {
+	for (int budget = 0; budget < HEADER_SIZE + DATA_SIZE; budget++) {
+		storage_log_t log;
+		spiflash_open(FLASH_SIZE);
+		reboot(&log);
+		CHECK(save(&log, 1));
+		CHECK(save(&log, 2));
+		spiflash_write_budget = budget;
+		CHECK(!save(&log, 3));
+		spiflash_write_budget = -1;
+
+		reboot(&log);
+		CHECK(loads(&log, 2));
+
+		// the torn slot is skipped, not written over
+		CHECK(save(&log, 4));
+		int expected_slot = budget == 0 ? 2 : 3;
+		CHECK(log.next_addr == BASE_ADDR + (expected_slot + 1) * RECORD_SIZE);
+		reboot(&log);
+		CHECK(loads(&log, 4));
+	}
+}
+
+// a torn last slot pushes the next save into the other sector, which gets erased
+static void test_dirty_slot_at_sector_end() {
+	storage_log_t log;
+	spiflash_open(FLASH_SIZE);
+	reboot(&log);
+	for (int n = 1; n < SLOTS / 2; n++) CHECK(save(&log, n));
+	spiflash_write_budget = 8;
+	CHECK(!save(&log, SLOTS / 2));
+	spiflash_write_budget = -1;
+
+	reboot(&log);
+	CHECK(loads(&log, SLOTS / 2 - 1));
+	int erases = spiflash_erase_count;
+	CHECK(save(&log, 100));
+	CHECK(spiflash_erase_count == erases + 1);
+	CHECK(log.next_addr == BASE_ADDR + STORAGE_SECTOR_SIZE + RECORD_SIZE);
+	reboot(&log);
+	CHECK(loads(&log, 100));
+}
+
+// a sector is erased only when the log enters it
+static void test_wrap() {
+	storage_log_t log;
+	spiflash_open(FLASH_SIZE);
+	reboot(&log);
+	for (int n = 1; n <= 3 * SLOTS; n++) {
+		CHECK(save(&log, n));
+		reboot(&log);
+		CHECK(loads(&log, n));
+	}
+	CHECK(spiflash_erase_count == 6);
+	CHECK(log.sequence == 3 * SLOTS);
+}
+
+// power cut between erasing the first sector and writing into it
+static void test_power_loss_after_erase() {
+	storage_log_t log;
+	spiflash_open(FLASH_SIZE);
+	reboot(&log);
+	for (int n = 1; n <= SLOTS; n++) CHECK(save(&log, n));
+	CHECK(log.next_addr == BASE_ADDR);
+	spiflash_write_budget = 0;
+	CHECK(!save(&log, SLOTS + 1));
+	spiflash_write_budget = -1;
+
+	reboot(&log);
+	CHECK(loads(&log, SLOTS));
+	CHECK(save(&log, SLOTS + 2));
+	reboot(&log);
+	CHECK(loads(&log, SLOTS + 2));
+}
+
+int main() {
+	test_empty();
+	test_torn_record();
+	test_dirty_slot_at_sector_end();
+	test_wrap();
+	test_power_loss_after_erase();
+	return TEST_RESULT("storage_test");
+}
@@ -0,0 +1,18 @@
+#ifndef task_h
+#define task_h
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+
+// one task on the host, the test itself stands in for everything else
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint16_t stack_depth,
+		void *parameters, UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+#endif
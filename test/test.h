@@ -0,0 +1,30 @@
+#ifndef test_h
+#define test_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// shared by the host tests: failures go to stderr so the firmware's own
+// logging on stdout can be thrown away
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+// what main returns
+#define TEST_RESULT(name) (fprintf(stderr, "%s: %s\n", name, failures ? "FAILED" : "ok"), failures != 0)
+
+// wall clock for the benchmarks, ns
+static inline uint64_t test_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef __WS2812_I2S_H__
+#define __WS2812_I2S_H__
+
+#include <stdint.h>
+
+// pixel type from esp-open-rtos' extras/ws2812_i2s, all the host build needs
+typedef union {
+    struct {
+        uint8_t blue;
+        uint8_t green;
+        uint8_t red;
+        uint8_t white;
+    };
+    uint32_t num;
+} ws2812_pixel_t;
+
+#endif
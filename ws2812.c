@@ -1,40 +1,95 @@
 #include "ws2812.h"
+#include "audio.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "FreeRTOS.h"
 #include "task.h"
 #include <math.h>
+#include <espressif/esp_system.h>
+
+#define SERVICE_PERIOD_MS 10
 
 ws2812_pixel_t WHITE = {{255,255,255,0}};
 
 int _led_count;
-int _order_type;
+int _output_count;
+ws2812_output_t **_outputs;
 
 typedef struct {
 	uint8_t blue;
     uint8_t green;
     uint8_t red;
     float brightness;
+    uint16_t level; // brightness in Q15, what the load and the frame use
     bool increasing;
 } working_pixel_t; 
 
 working_pixel_t *working_pixels;
-ws2812_pixel_t *pixel_buffer;
 ws2812_pixel_t *black;
+uint16_t *transition_pixels;       // outgoing frame in 8.8 per channel, frozen when a mode transition starts
+uint8_t *dither_error;             // fraction carried per channel by the temporal dither
+
+#define DITHER_MAX_LEVEL 32768     // Q16 pixel brightness, steps only show when dim
+#define LEVEL_ONE 32768            // 1.0 in Q15, pixel and global brightness
+#define DITHER_MAX_PERIOD 20000    // us between frames, 50fps and up
 
 bool _running = true;
 int _position = -1;
-float _brightness = 1.0f;
-int _color_count = 0;
-ws2812_pixel_t *_colors;
-int _mode_index = MD_SOLID;
-bool _reversed = false;
-int _delay = 0;
+uint16_t _phase = 0;
+uint32_t _beats_seen = 0;
 float _delay_factor = 1.0f;
-float _density = 0.25f;
-float _fade = 0.5f;
+
+// setters write _staged, the service task copies it to _live between frames
+// so effects never see a half applied change
+ws2812_params_t _staged = {
+	.mode_index = MD_SOLID,
+	.color_count = 0,
+	.brightness = 1.0f,
+	.delay = 0,
+	.reversed = false,
+	.density = 0.25f,
+	.fade = 0.5f
+};
+ws2812_params_t _live;
+const ws2812_params_t *_params = &_live;
+const ws2812_params_t *_recalled = NULL; // prebuilt set to switch to at the next frame
+bool _staged_dirty = false;
+bool _batching = false;
+
+int _active_mode = MD_SOLID;
+int _transition_duration = 500;
+uint32_t _crossfade_start = 0;   // mode crossfade and brightness ramp run on their own clocks
+bool _transition_frame = false;
+uint32_t _brightness_start = 0;
+float _brightness_from = 1.0f;
+float _brightness_to = 1.0f;
+
+// current limiter, setPixel and fadePixel keep the load up to date so a
+// frame is scaled before any of it is sent
+int _ma_per_channel = 20;
+int _power_limit = 0;          // mA, 0 for no limit
+uint32_t _working_load = 0;    // channels times pixel level summed over working_pixels
+uint32_t _transition_load = 0; // channels summed over the outgoing frame
+uint32_t _power_estimate = 0;  // mA of the last frame as sent
+
+uint32_t _last_frame_time = 0; // us
+
+// setters stay quiet until the first frame is out, the UART blocks once its
+// FIFO is full and the boot path would wait on every line
+bool _logging = false;
+
+TaskHandle_t _service_task;
+uint32_t _stats_start;
+uint32_t _stats_frames;
+uint32_t _stats_steps;
+uint32_t _stats_render_time;
+uint32_t _stats_render_time_max;
+uint32_t _stats_write_time;
+uint32_t _stats_skipped;
+uint32_t _stats_limited;
 
 int constrain(int input, int min, int max) {
 	if (input < min) return min;
@@ -44,48 +99,203 @@ int constrain(int input, int min, int max) {
 
 float constrainf(float input) {
 	if (input > 1.0f) return 1.0f;
-	if (input < _fade * 0.25f) return 0.0f;
+	if (input < _params->fade * 0.25f) return 0.0f;
 	return input;
 }
 
-void update() {
+uint32_t now_ms() {
+	return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+// transition progress as 0..256, 256 being done
+int transitionStep(uint32_t start) {
+	uint32_t elapsed = now_ms() - start;
+	if (elapsed >= _transition_duration) return 256;
+	return (elapsed << 8) / _transition_duration;
+}
+
+// brightness along the ramp, settles on the target once the ramp is done
+float currentBrightness() {
+	int t = transitionStep(_brightness_start);
+	if (t == 256) _brightness_from = _brightness_to;
+	return _brightness_from + (_brightness_to - _brightness_from) * t / 256.0f;
+}
+
+bool isTransitioning() {
+	return _transition_frame || _brightness_from != _brightness_to;
+}
+
+// pixel of the frame being shown as 8.8 fixed point channels, before the
+// current limit and the dither, brightness is Q15, returns the Q16 pixel
+// brightness
+int framePixel(int index, int brightness, int t, int *red, int *green, int *blue) {
+	working_pixel_t wp = working_pixels[index];
+	int level = (wp.level * brightness) >> 14;
+	*red = (wp.red * level) >> 8;
+	*green = (wp.green * level) >> 8;
+	*blue = (wp.blue * level) >> 8;
+	if (_transition_frame) {
+		// fixed point lerp from the frozen outgoing frame
+		uint16_t *from = &transition_pixels[index * 3];
+		*red = from[0] + (((*red - from[0]) * t) >> 8);
+		*green = from[1] + (((*green - from[1]) * t) >> 8);
+		*blue = from[2] + (((*blue - from[2]) * t) >> 8);
+	}
+	return level;
+}
+
+// freeze the frame being shown as the outgoing frame, taken before the
+// current limit so the blend is only scaled once, by its own estimate, and
+// before the dither so dim pixels keep their fraction
+void captureFrame() {
+	int t = transitionStep(_crossfade_start);
+	int brightness = currentBrightness() * LEVEL_ONE;
+	uint32_t load = 0;
 	for (int i = 0; i < _led_count; i++) {
-		int targetIndex = _reversed ? (_led_count - 1) - i : i;
-		working_pixel_t wp = working_pixels[i];
-		ws2812_pixel_t *p = &pixel_buffer[targetIndex];
-		if (_order_type == OT_RGB) {
-			// underlying library assumes ws2812 which is GRB bit ordering
-			p->green = wp.red;
-			p->red = wp.green;
-			p->blue = wp.blue;
-		}		
-		else {
-			// default GRB bit ordering
-			p->green = wp.green;
-			p->red = wp.red;
-			p->blue = wp.blue;
+		int red, green, blue;
+		framePixel(i, brightness, t, &red, &green, &blue);
+		uint16_t *tp = &transition_pixels[i * 3];
+		tp[0] = red;
+		tp[1] = green;
+		tp[2] = blue;
+		load += red + green + blue;
+	}
+	_transition_load = load >> 8;
+}
+
+void startCrossfade() {
+	captureFrame();
+	_transition_frame = true;
+	_crossfade_start = now_ms();
+}
+
+// called by the service task only, between frames, inside the critical
+// section so a preset store can't move the set while it is taken up
+void applyParams(const ws2812_params_t *params) {
+	if (params->brightness != _brightness_to) {
+		_brightness_from = currentBrightness();
+		_brightness_to = params->brightness;
+		_brightness_start = now_ms();
+	}
+	_params = params;
+}
+
+void applyStaged() {
+	taskENTER_CRITICAL();
+	// a batch may have begun since the flag was checked
+	if (_staged_dirty) {
+		_live = _staged;
+		applyParams(&_live);
+	}
+	_staged_dirty = false;
+	taskEXIT_CRITICAL();
+}
+
+void applyRecalled() {
+	taskENTER_CRITICAL();
+	// a store may have taken the recall back since the check
+	if (_recalled != NULL) applyParams(_recalled);
+	_recalled = NULL;
+	taskEXIT_CRITICAL();
+}
+
+// 8.8 fixed point channel to 8 bits, carrying the dropped fraction to the
+// next frame so the time average matches the 16 bit value
+uint8_t dither(uint16_t value, uint8_t *error) {
+	uint16_t sum = value + *error;
+	*error = sum & 0xFF;
+	return sum >> 8;
+}
+
+void update() {
+	int t = transitionStep(_crossfade_start);
+	if (t == 256) _transition_frame = false;
+	int brightness = currentBrightness() * LEVEL_ONE;
+
+	// Q8 is plenty for an estimate and keeps the product in 32 bits
+	uint32_t load = (_working_load * (brightness >> 7)) >> 8;
+	if (_transition_frame) load = _transition_load + ((((int) load - (int) _transition_load) * t) >> 8);
+	uint32_t estimate = load * _ma_per_channel / 255;
+	int scale = _power_limit > 0 && estimate > (uint32_t) _power_limit ? (_power_limit << 8) / estimate : 256;
+
+	// dithering only averages out when frames keep coming, the step interval
+	// is no guide since a step can only run once per service tick
+	uint32_t frame_time = sdk_system_get_time();
+	bool dithering = frame_time - _last_frame_time < DITHER_MAX_PERIOD || _transition_frame;
+	_last_frame_time = frame_time;
+
+	// async outputs come first so their transfers overlap encoding the rest
+	for (int o = 0; o < _output_count; o++) {
+		ws2812_output_t *output = _outputs[o];
+		for (int j = 0; j < output->led_count; j++) {
+			int i = output->offset + j;
+			int sourceIndex = _params->reversed ? (_led_count - 1) - i : i;
+			// channels are 8.8 fixed point from here until they are sent
+			int red, green, blue;
+			int level = framePixel(sourceIndex, brightness, t, &red, &green, &blue);
+			if (scale < 256) {
+				red = (red * scale) >> 8;
+				green = (green * scale) >> 8;
+				blue = (blue * scale) >> 8;
+			}
+			if (dithering && level < DITHER_MAX_LEVEL) {
+				uint8_t *error = &dither_error[sourceIndex * 3];
+				red = dither(red, &error[0]);
+				green = dither(green, &error[1]);
+				blue = dither(blue, &error[2]);
+			}
+			else {
+				red >>= 8;
+				green >>= 8;
+				blue >>= 8;
+			}
+			ws2812_pixel_t *p = &output->pixel_buffer[j];
+			if (output->order_type == OT_RGB) {
+				// underlying library assumes ws2812 which is GRB bit ordering
+				p->green = red;
+				p->red = green;
+				p->blue = blue;
+			}		
+			else {
+				// default GRB bit ordering
+				p->green = green;
+				p->red = red;
+				p->blue = blue;
+			}
 		}
-		float adjust = wp.brightness * _brightness;
-		p->green *= adjust;
-		p->red *= adjust;
-		p->blue *= adjust;
+		uint32_t write_start = sdk_system_get_time();
+		output->write(output, output->pixel_buffer);
+		_stats_write_time += sdk_system_get_time() - write_start;
 	}
-	ws2812_i2s_update(pixel_buffer, PIXEL_RGB);
+	_stats_frames++;
+
+	_power_estimate = (estimate * scale) >> 8;
+	if (scale < 256) _stats_limited++;
+}
+
+uint32_t pixelLoad(const working_pixel_t *wp) {
+	return ((wp->red + wp->green + wp->blue) * wp->level) >> 15;
 }
 
 void setPixel(int index, ws2812_pixel_t color, float brightnessMod) {
 	working_pixel_t *wp = &working_pixels[index];
+	_working_load -= pixelLoad(wp);
 	wp->red = color.red;
 	wp->green = color.green;
 	wp->blue = color.blue;
 	wp->brightness = brightnessMod;
+	wp->level = brightnessMod * LEVEL_ONE;
 	wp->increasing = false;
+	_working_load += pixelLoad(wp);
 }
 
 void fadePixel(int index, float brightnessMod) {
 	working_pixel_t *wp = &working_pixels[index];
 	if (wp->increasing) brightnessMod = 1.0f / brightnessMod;
+	_working_load -= pixelLoad(wp);
 	wp->brightness = constrainf(wp->brightness * brightnessMod);
+	wp->level = wp->brightness * LEVEL_ONE;
+	_working_load += pixelLoad(wp);
 }
 
 void setFade(int index, bool increasing) {
@@ -101,19 +311,19 @@ bool isDark(int index) {
 }
 
 void solid() {
-	if (_color_count > 0) {
+	if (_params->color_count > 0) {
 		for (int i = 0; i < _led_count; i++) {
-			setPixel(i, _colors[0], 1.0f);
+			setPixel(i, _params->colors[0], 1.0f);
 		}
 		update();
 	}
 }
 
 void chase() {
-	_position = (_position + 1) % _color_count;
+	_position = (_position + 1) % _params->color_count;
 	for (int i = 0; i < _led_count; i++) {
-		int mod = i % _color_count;
-		setPixel(i, _colors[i % _color_count], 1 / pow(2, floor(abs(_position - mod) / (_color_count * _fade * 0.25f))));
+		int mod = i % _params->color_count;
+		setPixel(i, _params->colors[i % _params->color_count], 1 / pow(2, floor(abs(_position - mod) / (_params->color_count * _params->fade * 0.25f))));
 	}
 	update();
 }
@@ -123,12 +333,12 @@ void twinkle() {
 		if (isBright(i)) {
 			setFade(i, false);
 		}
-		fadePixel(i, _fade);
+		fadePixel(i, _params->fade);
 	}
-	for (int i = _led_count * _density; i > 0; i--) {
+	for (int i = _led_count * _params->density; i > 0; i--) {
 		int index = rand() % _led_count;
 		if (isDark(index)) {
-			setPixel(index, _colors[index % _color_count], _fade * 0.25f);
+			setPixel(index, _params->colors[index % _params->color_count], _params->fade * 0.25f);
 			setFade(index, true);
 		}
 	}
@@ -136,29 +346,29 @@ void twinkle() {
 }
 
 void rotation(int width) {
-	_position = (_position + 1) % (_color_count * width);
-	int colorIndex = (_position / width) % _color_count;
+	_position = (_position + 1) % (_params->color_count * width);
+	int colorIndex = (_position / width) % _params->color_count;
 	for (int i = 0; i < _led_count; i++) {
 		int mod = (i + _position) % width;
-		if (mod == 0 && i > 0) colorIndex = (colorIndex + 1) % _color_count;
+		if (mod == 0 && i > 0) colorIndex = (colorIndex + 1) % _params->color_count;
 
-		setPixel(i, _colors[colorIndex], 1.0f);
+		setPixel(i, _params->colors[colorIndex], 1.0f);
 	}
 	update();
 }
 
 void comets() {
-	int width = _led_count * _density;
-	_position = (_position + 1) % (_color_count * width);
-	int colorIndex = (_position / width) % _color_count;
+	int width = _led_count * _params->density;
+	_position = (_position + 1) % (_params->color_count * width);
+	int colorIndex = (_position / width) % _params->color_count;
 	for (int i = 0; i < _led_count; i++) {
 		int mod = (i + _position) % width;
-		if (mod == 0 && i > 0) colorIndex = (colorIndex + 1) % _color_count;
+		if (mod == 0 && i > 0) colorIndex = (colorIndex + 1) % _params->color_count;
 		if (mod == 0) {
 			setPixel(i, WHITE, 1.0f);
 		}
 		else {
-			setPixel(i, _colors[colorIndex], 1 / pow(2, floor(mod / (width * _fade * 0.25f))));
+			setPixel(i, _params->colors[colorIndex], 1 / pow(2, floor(mod / (width * _params->fade * 0.25f))));
 		}
 	}
 	update();
@@ -166,129 +376,461 @@ void comets() {
 
 void fireworks() {
 	for (int i = 0; i < _led_count; i++) {
-		fadePixel(i, _fade);
+		fadePixel(i, _params->fade);
 	}
-	for (int i = _led_count * _density; i > 0; i--) {
+	for (int i = _led_count * _params->density; i > 0; i--) {
 		int index = rand() % _led_count;
-		setPixel(index, _colors[rand() % _color_count], 1.0f);
+		setPixel(index, _params->colors[rand() % _params->color_count], 1.0f);
 	}
 	update();
 }
 
+// fixed point kernel for the organic effects, all 8 bit with 8.8 coordinates
+
+// 128 + 127 * sin(i * 2 * M_PI / 256) truncated, worked out here rather
+// than with 256 soft float sin() calls at boot
+static const uint8_t sin8_table[256] = {
+	128, 131, 134, 137, 140, 143, 146, 149, 152, 155, 158, 161, 164, 167, 170, 173,
+	176, 179, 182, 185, 187, 190, 193, 195, 198, 201, 203, 206, 208, 210, 213, 215,
+	217, 219, 222, 224, 226, 228, 230, 231, 233, 235, 236, 238, 240, 241, 242, 244,
+	245, 246, 247, 248, 249, 250, 251, 251, 252, 253, 253, 254, 254, 254, 254, 254,
+	255, 254, 254, 254, 254, 254, 253, 253, 252, 251, 251, 250, 249, 248, 247, 246,
+	245, 244, 242, 241, 240, 238, 236, 235, 233, 231, 230, 228, 226, 224, 222, 219,
+	217, 215, 213, 210, 208, 206, 203, 201, 198, 195, 193, 190, 187, 185, 182, 179,
+	176, 173, 170, 167, 164, 161, 158, 155, 152, 149, 146, 143, 140, 137, 134, 131,
+	128, 124, 121, 118, 115, 112, 109, 106, 103, 100, 97, 94, 91, 88, 85, 82,
+	79, 76, 73, 70, 68, 65, 62, 60, 57, 54, 52, 49, 47, 45, 42, 40,
+	38, 36, 33, 31, 29, 27, 25, 24, 22, 20, 19, 17, 15, 14, 13, 11,
+	10, 9, 8, 7, 6, 5, 4, 4, 3, 2, 2, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 2, 2, 3, 4, 4, 5, 6, 7, 8, 9,
+	10, 11, 13, 14, 15, 17, 19, 20, 22, 24, 25, 27, 29, 31, 33, 36,
+	38, 40, 42, 45, 47, 49, 52, 54, 57, 60, 62, 65, 68, 70, 73, 76,
+	79, 82, 85, 88, 91, 94, 97, 100, 103, 106, 109, 112, 115, 118, 121, 124
+};
+
+uint8_t sin8(uint8_t theta) {
+	return sin8_table[theta];
+}
+
+uint8_t lerp8(uint8_t a, uint8_t b, uint8_t frac) {
+	return a + (((b - a) * frac) >> 8);
+}
+
+// 3t^2 - 2t^3 so the noise lattice doesn't show
+uint8_t ease8(uint8_t t) {
+	int t2 = (t * t) >> 8;
+	int eased = 3 * t2 - ((2 * t2 * t) >> 8);
+	return eased > 255 ? 255 : eased;
+}
+
+uint8_t hash8(uint16_t x, uint16_t y) {
+	uint32_t h = x * 374761393u + y * 668265263u;
+	h = (h ^ (h >> 13)) * 1274126177u;
+	return h >> 24;
+}
+
+// 2D value noise, x and y are 8.8 fixed point
+uint8_t noise8(uint16_t x, uint16_t y) {
+	uint16_t xi = x >> 8;
+	uint16_t yi = y >> 8;
+	uint8_t fx = ease8(x & 0xFF);
+	uint8_t fy = ease8(y & 0xFF);
+	uint8_t top = lerp8(hash8(xi, yi), hash8(xi + 1, yi), fx);
+	uint8_t bottom = lerp8(hash8(xi, yi + 1), hash8(xi + 1, yi + 1), fx);
+	return lerp8(top, bottom, fy);
+}
+
+// maps 0..255 around the active colors, blending between neighbours
+ws2812_pixel_t paletteColor(uint8_t index) {
+	ws2812_pixel_t color = {{ 0, 0, 0, 0 }};
+	int count = _params->color_count;
+	if (count == 0) return color;
+	uint16_t scaled = index * count;
+	const ws2812_pixel_t *a = &_params->colors[scaled >> 8];
+	const ws2812_pixel_t *b = &_params->colors[((scaled >> 8) + 1) % count];
+	uint8_t frac = scaled & 0xFF;
+	color.red = lerp8(a->red, b->red, frac);
+	color.green = lerp8(a->green, b->green, frac);
+	color.blue = lerp8(a->blue, b->blue, frac);
+	return color;
+}
+
+void plasma() {
+	_phase++;
+	// density sets the wavelength
+	int scale = 1 + _params->density * 16;
+	for (int i = 0; i < _led_count; i++) {
+		uint8_t x = i * scale;
+		int v = sin8(x + _phase) + sin8((x >> 1) - (_phase << 1)) + sin8(x * 3 + (_phase >> 1));
+		setPixel(i, paletteColor(v / 3), 1.0f);
+	}
+	update();
+}
+
+void flowNoise() {
+	_phase += 4;
+	int scale = 8 + _params->density * 120;
+	for (int i = 0; i < _led_count; i++) {
+		setPixel(i, paletteColor(noise8(i * scale, _phase)), 1.0f);
+	}
+	update();
+}
+
+void gradient() {
+	_phase++;
+	// 8.8 palette step per pixel so the palette spans the strip once
+	uint32_t step = (256 << 8) / _led_count;
+	for (int i = 0; i < _led_count; i++) {
+		setPixel(i, paletteColor(((i * step) >> 8) + _phase), 1.0f);
+	}
+	update();
+}
+
+// band levels across the strip, lowest frequency first
+void spectrum() {
+	const audio_levels_t *levels = audio_levels();
+	int width = _led_count / AUDIO_BAND_COUNT;
+	if (width == 0) width = 1;
+	for (int i = 0; i < _led_count; i++) {
+		int band = i / width;
+		if (band >= AUDIO_BAND_COUNT) band = AUDIO_BAND_COUNT - 1;
+		setPixel(i, paletteColor(band * 256 / AUDIO_BAND_COUNT), levels->bands[band] / 255.0f);
+	}
+	update();
+}
+
+// whole strip flashes the next color on each beat and fades in between
+void pulse() {
+	const audio_levels_t *levels = audio_levels();
+	if (levels->beats != _beats_seen && _params->color_count > 0) {
+		_beats_seen = levels->beats;
+		_position = (_position + 1) % _params->color_count;
+		for (int i = 0; i < _led_count; i++) {
+			setPixel(i, _params->colors[_position], 1.0f);
+		}
+	}
+	else {
+		for (int i = 0; i < _led_count; i++) {
+			fadePixel(i, _params->fade);
+		}
+	}
+	update();
+}
+
+bool isAudioMode(int mode_index) {
+	return mode_index == MD_SPECTRUM || mode_index == MD_PULSE;
+}
+
+void renderStep() {
+	switch (_active_mode) {
+		case MD_SOLID:
+			_delay_factor = 1.0;
+			solid();
+			break;
+		case MD_CHASE:
+			_delay_factor = 2.0;
+			chase();
+			break;
+		case MD_TWINKLE:
+			_delay_factor = 2.0;
+			twinkle();
+			break;
+		case MD_SEQUENCE:
+			_delay_factor = 1.5f;
+			rotation(1);
+			break;
+		case MD_STRIPES:
+			_delay_factor = 1.0;
+			rotation(_led_count * _params->density);
+			break;
+		case MD_COMETS:
+			_delay_factor = 2.0;
+			comets();
+			break;
+		case MD_FIREWORKS:
+			_delay_factor = 2.0;
+			fireworks();
+			break;
+		case MD_PLASMA:
+			_delay_factor = 0.5f;
+			plasma();
+			break;
+		case MD_NOISE:
+			_delay_factor = 0.5f;
+			flowNoise();
+			break;
+		case MD_GRADIENT:
+			_delay_factor = 0.5f;
+			gradient();
+			break;
+		case MD_SPECTRUM:
+			_delay_factor = 0.25f;
+			spectrum();
+			break;
+		case MD_PULSE:
+			_delay_factor = 0.25f;
+			pulse();
+			break;
+		default:
+			solid();
+	}
+}
+
 void ws2812_service(void *_args) {
 	uint32_t now = 0;
 	uint32_t last_call_time = 0;
 
 	while (true) {
+		// sampling only runs while an audio effect is showing
+		audio_enable(_running && isAudioMode(_active_mode));
+
+		if (_recalled != NULL) applyRecalled();
+		if (_staged_dirty) applyStaged();
+
+		if (_params->mode_index != _active_mode) {
+			_active_mode = _params->mode_index;
+			// while off the output buffers hold the last frame before the strip
+			// went dark, the new effect starts straight from black instead
+			if (_running) startCrossfade();
+			last_call_time = 0;
+		}
+
 		if (_running) {
-			now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+			now = now_ms();
+
+			// bounded analysis every tick so it keeps up with the sample rate
+			audio_step();
 			
-			if (now - last_call_time > _delay * _delay_factor) {
+			int interval = _params->delay * _delay_factor;
+			if (now - last_call_time > interval) {
+				// steps only run on service ticks, so on time is the first tick past
+				// the interval; every whole such period of lateness is a step that
+				// didn't happen
+				uint32_t period = (interval / SERVICE_PERIOD_MS + 1) * SERVICE_PERIOD_MS;
+				uint32_t elapsed = now - last_call_time;
+				if (last_call_time > 0 && elapsed > period) {
+					_stats_skipped += (elapsed - period) / period;
+				}
 				last_call_time = now;
+				uint32_t render_start = sdk_system_get_time();
 
-				switch (_mode_index) {
-					case MD_SOLID:
-						_delay_factor = 1.0;
-						solid();
-						break;
-					case MD_CHASE:
-						_delay_factor = 2.0;
-						chase();
-						break;
-					case MD_TWINKLE:
-						_delay_factor = 2.0;
-						twinkle();
-						break;
-					case MD_SEQUENCE:
-						_delay_factor = 1.5f;
-						rotation(1);
-						break;
-					case MD_STRIPES:
-						_delay_factor = 1.0;
-						rotation(_led_count * _density);
-						break;
-					case MD_COMETS:
-						_delay_factor = 2.0;
-						comets();
-						break;
-					case MD_FIREWORKS:
-						_delay_factor = 2.0;
-						fireworks();
-						break;
-					default:
-						solid();
-				}
+				renderStep();
+				uint32_t render_time = sdk_system_get_time() - render_start;
+				_stats_steps++;
+				_stats_render_time += render_time;
+				if (render_time > _stats_render_time_max) _stats_render_time_max = render_time;
+			}
+			else if (isTransitioning()) {
+				// effect isn't due yet, keep the blend moving
+				update();
 			}
 		}
-		vTaskDelay(10 / portTICK_PERIOD_MS);
+		vTaskDelay(SERVICE_PERIOD_MS / portTICK_PERIOD_MS);
 	}
 }
 
-void ws2812_init(int pixel_number, int order_type) {
+void ws2812_init(int output_count, ws2812_output_t **outputs) {
 	time_t t;
 	srand((unsigned) time(&t));
-	
-	_led_count = pixel_number;
-	_order_type = order_type;
 
-	working_pixels = (working_pixel_t*) malloc(_led_count * sizeof(working_pixel_t));
-	pixel_buffer = (ws2812_pixel_t*) malloc(_led_count * sizeof(ws2812_pixel_t));
-	black = (ws2812_pixel_t*) malloc(_led_count * sizeof(ws2812_pixel_t));
+	_output_count = output_count;
+	_outputs = (ws2812_output_t**) malloc(_output_count * sizeof(ws2812_output_t*));
+
+	// frame offsets follow declaration order, write order puts async outputs first
+	_led_count = 0;
+	int max_count = 0;
+	int async_index = 0;
+	for (int o = 0; o < _output_count; o++) {
+		ws2812_output_t *output = outputs[o];
+		output->offset = _led_count;
+		_led_count += output->led_count;
+		if (output->led_count > max_count) max_count = output->led_count;
+		if (output->async) {
+			memmove(&_outputs[async_index + 1], &_outputs[async_index], (o - async_index) * sizeof(ws2812_output_t*));
+			_outputs[async_index++] = output;
+		}
+		else {
+			_outputs[o] = output;
+		}
+		output->init(output);
+	}
 
-	for (int i = 0; i < _led_count; i++) {
+	working_pixels = (working_pixel_t*) calloc(_led_count, sizeof(working_pixel_t));
+	black = (ws2812_pixel_t*) malloc(max_count * sizeof(ws2812_pixel_t));
+	transition_pixels = (uint16_t*) malloc(_led_count * 3 * sizeof(uint16_t));
+	dither_error = (uint8_t*) calloc(_led_count * 3, sizeof(uint8_t));
+
+	for (int i = 0; i < max_count; i++) {
 		black[i].red = black[i].green = black[i].blue = 0;
 	}
-	
-	ws2812_i2s_init(_led_count, PIXEL_RGB);
 
-	xTaskCreate(ws2812_service, "ws2812Service", 255, NULL, 2, NULL);
+	// first frame goes out now, before the scheduler and network stack start,
+	// and without a transition since the strip was dark
+	_live = _staged;
+	_staged_dirty = false;
+	_active_mode = _live.mode_index;
+	_brightness_from = _brightness_to = _live.brightness;
+	_transition_frame = false;
+	if (_running) renderStep();
+
+	_stats_start = sdk_system_get_time();
+	xTaskCreate(ws2812_service, "ws2812Service", 255, NULL, 2, &_service_task);
+	_logging = true;
 }
 
 void ws2812_on(bool on) {
 	_running = on;
 	if (!_running) {
-		ws2812_i2s_update(black, PIXEL_RGB);
+		for (int o = 0; o < _output_count; o++) {
+			_outputs[o]->write(_outputs[o], black);
+		}
 	}
-	printf("ws2812: on: %d\n", _running);
+	if (_logging) printf("ws2812: on: %d\n", _running);
+}
+
+void stageChanged() {
+	if (!_batching) _staged_dirty = true;
+}
+
+int toDelay(int speed) {
+	// max delay 250ms, min delay 0ms
+	return speed * -2.5f + 250;
+}
+
+float toFade(int fade) {
+	return (100.0f - fade) / 100.0f;
 }
 
 void ws2812_setColors(int color_count, ws2812_pixel_t *colors) {
-	_color_count = color_count;
-	_colors = colors;
-	printf("ws2812: setColors: color_count: %d\n", _color_count);
-	for (int i = 0; i < _color_count; i++) {
+	if (color_count > WS2812_MAX_COLORS) color_count = WS2812_MAX_COLORS;
+	taskENTER_CRITICAL();
+	_staged.color_count = color_count;
+	memcpy(_staged.colors, colors, color_count * sizeof(ws2812_pixel_t));
+	stageChanged();
+	taskEXIT_CRITICAL();
+	if (!_logging) return;
+	printf("ws2812: setColors: color_count: %d\n", _staged.color_count);
+	for (int i = 0; i < _staged.color_count; i++) {
 		printf("ws2812: setColors: color: %d %02x%02x%02x\n", 
-			i, _colors[i].red, _colors[i].green, _colors[i].blue);
+			i, _staged.colors[i].red, _staged.colors[i].green, _staged.colors[i].blue);
 	}
 }
 
 void ws2812_setBrightness(int brightness) {
-	_brightness = brightness / 100.0f;
-	printf("ws2812: setBrightness: %f\n", _brightness);
+	_staged.brightness = brightness / 100.0f;
+	stageChanged();
+	if (_logging) printf("ws2812: setBrightness: %f\n", _staged.brightness);
 }
 
 void ws2812_setMode(int mode_index) {
-	_mode_index = mode_index;
-	printf("ws2812: setMode: %d\n", _mode_index);
+	_staged.mode_index = mode_index;
+	stageChanged();
+	if (_logging) printf("ws2812: setMode: %d\n", _staged.mode_index);
 }
 
 void ws2812_setSpeed(int speed) {
-	// max delay 250ms, min delay 0ms
-	_delay = speed * -2.5f + 250;
-	printf("ws2812: setSpeed: %d\n", _delay);
+	_staged.delay = toDelay(speed);
+	stageChanged();
+	if (_logging) printf("ws2812: setSpeed: %d\n", _staged.delay);
 }
 
 void ws2812_setReverseDirection(bool reversed) {
-	_reversed = reversed;
-	printf("ws2812: setReversedDirection: %d\n", _reversed);
+	_staged.reversed = reversed;
+	stageChanged();
+	if (_logging) printf("ws2812: setReversedDirection: %d\n", _staged.reversed);
 }
 
 void ws2812_setDensity(int density) {
-	_density = density / 100.0f;
-	printf("ws2812: setDensity: %f\n", _density);
+	_staged.density = density / 100.0f;
+	stageChanged();
+	if (_logging) printf("ws2812: setDensity: %f\n", _staged.density);
 }
 
 void ws2812_setFade(int fade) {
-	_fade = (100.0f - fade) / 100.0f;
-	printf("ws2812: setFade: %f\n'", _fade);
+	_staged.fade = toFade(fade);
+	stageChanged();
+	if (_logging) printf("ws2812: setFade: %f\n", _staged.fade);
+}
+
+void ws2812_beginBatch() {
+	taskENTER_CRITICAL();
+	// anything staged but not yet applied goes out with the batch, so the
+	// service task never copies _staged while the batch is writing it
+	_batching = true;
+	_staged_dirty = false;
+	taskEXIT_CRITICAL();
 }
+
+void ws2812_commitBatch() {
+	_batching = false;
+	_staged_dirty = true;
+	if (_logging) printf("ws2812: commitBatch\n");
+}
+
+void ws2812_initParams(ws2812_params_t *params, int color_count, ws2812_pixel_t *colors,
+		int brightness, int mode_index, int speed, bool reversed, int density, int fade) {
+	if (color_count > WS2812_MAX_COLORS) color_count = WS2812_MAX_COLORS;
+	params->mode_index = mode_index;
+	params->color_count = color_count;
+	memcpy(params->colors, colors, color_count * sizeof(ws2812_pixel_t));
+	params->brightness = brightness / 100.0f;
+	params->delay = toDelay(speed);
+	params->reversed = reversed;
+	params->density = density / 100.0f;
+	params->fade = toFade(fade);
+}
+
+void ws2812_recallParams(const ws2812_params_t *params) {
+	taskENTER_CRITICAL();
+	// later setters continue from the recalled set
+	_staged = *params;
+	_staged_dirty = false;
+	_recalled = params;
+	taskEXIT_CRITICAL();
+	if (_logging) printf("ws2812: recallParams: mode: %d\n", params->mode_index);
+}
+
+void ws2812_storeParams(ws2812_params_t *slot, const ws2812_params_t *params) {
+	taskENTER_CRITICAL();
+	// the strip keeps showing what the slot held, from a copy, until
+	// something else is applied
+	if (_params == slot) {
+		_live = *slot;
+		_params = &_live;
+	}
+	// a recall still waiting already left that in _staged
+	if (_recalled == slot) {
+		_recalled = NULL;
+		_staged_dirty = true;
+	}
+	*slot = *params;
+	taskEXIT_CRITICAL();
+}
+
+void ws2812_setPowerBudget(int ma_per_channel, int limit) {
+	_ma_per_channel = ma_per_channel;
+	_power_limit = limit;
+	if (_logging) printf("ws2812: setPowerBudget: %dmA per channel, limit %dmA\n", _ma_per_channel, _power_limit);
+}
+
+void ws2812_setTransition(int duration) {
+	_transition_duration = duration;
+	if (_logging) printf("ws2812: setTransition: %d\n", _transition_duration);
+}
+
+void ws2812_getStats(ws2812_stats_t *stats) {
+	taskENTER_CRITICAL();
+	uint32_t now = sdk_system_get_time();
+	stats->window = (now - _stats_start) / 1000;
+	stats->frames = _stats_frames;
+	stats->render_time_avg = _stats_steps > 0 ? _stats_render_time / _stats_steps : 0;
+	stats->render_time_max = _stats_render_time_max;
+	stats->write_time_avg = _stats_frames > 0 ? _stats_write_time / _stats_frames : 0;
+	stats->skipped_frames = _stats_skipped;
+	stats->limited_frames = _stats_limited;
+	stats->current = _power_estimate;
+	_stats_start = now;
+	_stats_frames = _stats_steps = _stats_render_time = _stats_render_time_max = _stats_write_time = _stats_skipped = _stats_limited = 0;
+	taskEXIT_CRITICAL();
+	stats->stack_free = uxTaskGetStackHighWaterMark(_service_task);
+}
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define ws2812_h
 
 #include "ws2812_i2s/ws2812_i2s.h"
+#include "ws2812_output.h"
 
 #define MD_SOLID            1 // solid color
 #define MD_CHASE			2 // static colors with dimming chase
@@ -10,15 +11,49 @@
 #define MD_STRIPES          5 // stripes of colors density variable pixels each
 #define MD_COMETS           6 // comets of colors
 #define MD_FIREWORKS        7 // random pixels light up with one of the colors and fade
+#define MD_PLASMA           8 // overlapping sine waves mapped onto the colors
+#define MD_NOISE            9 // flowing value noise mapped onto the colors
+#define MD_GRADIENT         10 // colors blended across the strip, scrolling
+#define MD_SPECTRUM         11 // audio band levels across the strip
+#define MD_PULSE            12 // flashes the next color on each audio beat
+#define MD_LAST             MD_PULSE
 
 // byte order type for WS281x serial data protocol
 #define OT_GRB				0
 #define OT_RGB				1
 
-void ws2812_init(int pixel_number, int order_type);
+#define WS2812_MAX_COLORS	7
+
+// everything the effects read, changed as a whole between frames
+typedef struct {
+	int mode_index;
+	int color_count;
+	ws2812_pixel_t colors[WS2812_MAX_COLORS];
+	float brightness;
+	int delay;
+	bool reversed;
+	float density;
+	float fade;
+} ws2812_params_t;
+
+typedef struct {
+	uint32_t window;          // ms covered by these numbers
+	uint32_t frames;          // frames sent to the outputs
+	uint32_t render_time_avg; // us per effect step, including output writes
+	uint32_t render_time_max; // us
+	uint32_t write_time_avg;  // us per frame spent in output writes (I2S wait + encode)
+	uint32_t skipped_frames;  // effect steps missed because the service ran late
+	uint32_t limited_frames;  // frames scaled down to stay within the power budget
+	uint32_t current;         // estimated mA of the last frame
+	uint32_t stack_free;      // ws2812Service stack high water mark in words
+} ws2812_stats_t;
+
+// outputs are concatenated into one logical strip in the given order
+void ws2812_init(int output_count, ws2812_output_t **outputs);
 
 void ws2812_on(bool on);
 
+// colors are copied, at most WS2812_MAX_COLORS
 void ws2812_setColors(int color_count, ws2812_pixel_t *colors);
 
 void ws2812_setBrightness(int brightness);
@@ -33,4 +68,31 @@ void ws2812_setDensity(int density);
 
 void ws2812_setFade(int fade);
 
+// setters between these two are applied together at the next frame boundary
+void ws2812_beginBatch();
+
+void ws2812_commitBatch();
+
+// fills params from HomeKit style values, converted like the setters do
+void ws2812_initParams(ws2812_params_t *params, int color_count, ws2812_pixel_t *colors,
+		int brightness, int mode_index, int speed, bool reversed, int density, int fade);
+
+// switches to a prebuilt set at the next frame boundary without copying it,
+// params must stay valid until something else is applied
+void ws2812_recallParams(const ws2812_params_t *params);
+
+// replaces a prebuilt set in one go, safe while it is showing or waiting to
+// be recalled, build params elsewhere first
+void ws2812_storeParams(ws2812_params_t *slot, const ws2812_params_t *params);
+
+// estimated draw of one channel at full on and the supply limit in mA,
+// frames over the limit are scaled down as a whole, 0 disables limiting
+void ws2812_setPowerBudget(int ma_per_channel, int limit);
+
+// crossfade duration in ms for mode and brightness changes
+void ws2812_setTransition(int duration);
+
+// fills stats for the window since the previous call and starts a new window
+void ws2812_getStats(ws2812_stats_t *stats);
+
 #endif
@@ -0,0 +1,53 @@
+#include "ws2812_output.h"
+
+#include <stdlib.h>
+#include <esp8266.h>
+#include "ws2812/ws2812.h"
+
+static ws2812_output_t *output_alloc(int led_count, int order_type) {
+	ws2812_output_t *output = (ws2812_output_t*) calloc(1, sizeof(ws2812_output_t));
+	output->led_count = led_count;
+	output->order_type = order_type;
+	output->pixel_buffer = (ws2812_pixel_t*) calloc(led_count, sizeof(ws2812_pixel_t));
+	return output;
+}
+
+static void i2s_init(ws2812_output_t *output) {
+	ws2812_i2s_init(output->led_count, PIXEL_RGB);
+}
+
+static void i2s_write(ws2812_output_t *output, ws2812_pixel_t *pixels) {
+	// waits for the previous DMA transfer, encodes and starts the next one
+	ws2812_i2s_update(pixels, PIXEL_RGB);
+}
+
+ws2812_output_t *ws2812_output_i2s(int led_count, int order_type) {
+	ws2812_output_t *output = output_alloc(led_count, order_type);
+	output->async = true;
+	output->init = i2s_init;
+	output->write = i2s_write;
+	return output;
+}
+
+static void bitbang_init(ws2812_output_t *output) {
+	gpio_enable(output->gpio, GPIO_OUTPUT);
+	gpio_write(output->gpio, 0);
+}
+
+static void bitbang_write(ws2812_output_t *output, ws2812_pixel_t *pixels) {
+	ws2812_seq_start();
+	for (int i = 0; i < output->led_count; i++) {
+		// pixels are already in GRB wire order, ws2812_seq_rgb sends green first
+		ws2812_seq_rgb(output->gpio, (pixels[i].red << 16) | (pixels[i].green << 8) | pixels[i].blue);
+	}
+	ws2812_seq_end();
+}
+
+ws2812_output_t *ws2812_output_bitbang(int led_count, int order_type, int gpio) {
+	ws2812_output_t *output = output_alloc(led_count, order_type);
+	output->async = false;
+	output->gpio = gpio;
+	output->init = bitbang_init;
+	output->write = bitbang_write;
+	return output;
+}
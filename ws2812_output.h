@@ -0,0 +1,29 @@
+#ifndef ws2812_output_h
+#define ws2812_output_h
+
+#include <stdbool.h>
+
+#include "ws2812_i2s/ws2812_i2s.h"
+
+typedef struct ws2812_output ws2812_output_t;
+
+// one physical strip, fed a slice of the rendered frame
+struct ws2812_output {
+	int led_count;
+	int order_type;
+	int offset;             // first pixel of the rendered frame on this strip
+	bool async;             // write returns while the transfer is still running
+	int gpio;
+	ws2812_pixel_t *pixel_buffer;
+	void (*init)(ws2812_output_t *output);
+	void (*write)(ws2812_output_t *output, ws2812_pixel_t *pixels);
+};
+
+// I2S DMA on GPIO3 (RX), only one of these per device
+ws2812_output_t *ws2812_output_i2s(int led_count, int order_type);
+
+// bit-banged on any free GPIO, interrupts are off for the whole transfer
+// (~30us per pixel) so keep these strips short
+ws2812_output_t *ws2812_output_bitbang(int led_count, int order_type, int gpio);
+
+#endif